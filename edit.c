@@ -1,11 +1,12 @@
 #include "edit.h"
 
+#include "job.h"
 #include "lines.h"
 #include "sbuf.h"
 #include "status.h"
 #include "term.h"
+#include "text.h"
 #include "undo.h"
-#include "utf.h"
 
 /*
  * editing + motions.
@@ -54,12 +55,12 @@ visrange(struct editor *e, size_t *a, size_t *b)
 		return 0;
 	lo = e->vmark < e->cur ? e->vmark : e->cur;
 	hi = e->vmark < e->cur ? e->cur : e->vmark;
-	if (hi < e->buf.len)
-		hi = utfnext(e->buf.s, e->buf.len, hi);
-	if (lo > e->buf.len)
-		lo = e->buf.len;
-	if (hi > e->buf.len)
-		hi = e->buf.len;
+	if (hi < textlen(e))
+		hi = textnext(e, hi);
+	if (lo > textlen(e))
+		lo = textlen(e);
+	if (hi > textlen(e))
+		hi = textlen(e);
 	*a = lo;
 	*b = hi;
 	return 1;
@@ -91,14 +92,14 @@ cclass(int c)
 size_t
 motionh(struct editor *e, size_t p)
 {
-	return utfprev(e->buf.s, e->buf.len, p);
+	return textprev(e, p);
 }
 
 /* motionl moves right by one codepoint. */
 size_t
 motionl(struct editor *e, size_t p)
 {
-	return utfnext(e->buf.s, e->buf.len, p);
+	return textnext(e, p);
 }
 
 /* motionbol moves to beginning of line. */
@@ -115,7 +116,7 @@ motioneol(struct editor *e, size_t p)
 	size_t le;
 
 	le = lineend(e, p);
-	if (le > 0 && le == e->buf.len)
+	if (le > 0 && le == textlen(e))
 		return le;
 	return le;
 }
@@ -124,7 +125,8 @@ motioneol(struct editor *e, size_t p)
 size_t
 motionj(struct editor *e, size_t p)
 {
-	int row, col;
+	size_t row;
+	int col;
 	size_t np;
 	size_t ls, le;
 
@@ -140,13 +142,14 @@ motionj(struct editor *e, size_t p)
 size_t
 motionk(struct editor *e, size_t p)
 {
-	int row, col;
+	size_t row;
+	int col;
 	size_t np;
 	size_t ls, le;
 
 	row = off2row(e, p);
 	col = off2col(e, p);
-	np = row2off(e, row - 1);
+	np = row2off(e, row > 0 ? row - 1 : 0);
 	ls = np;
 	le = lineend(e, ls);
 	return offatcol(e, ls, le, col);
@@ -176,7 +179,7 @@ motiont(struct editor *e, size_t p, int ch, int n)
 	size_t scan, ls, le;
 	int k;
 
-	if (p >= e->buf.len)
+	if (p >= textlen(e))
 		return p;
 
 	scan = p;
@@ -190,13 +193,13 @@ motiont(struct editor *e, size_t p, int ch, int n)
 		ls = linestart(e, scan);
 		le = lineend(e, scan);
 
-		start = utfnext(e->buf.s, e->buf.len, scan);
+		start = textnext(e, scan);
 		if (start > le)
 			return p;
 
 		found = le;
 		for (i = start; i < le; i++) {
-			if ((unsigned char)e->buf.s[i] == (unsigned char)ch) {
+			if (textbyte(e, i) == (unsigned char)ch) {
 				found = i;
 				break;
 			}
@@ -209,7 +212,7 @@ motiont(struct editor *e, size_t p, int ch, int n)
 
 	if (scan <= ls)
 		return ls;
-	return utfprev(e->buf.s, e->buf.len, scan);
+	return textprev(e, scan);
 }
 
 /* motionf searches for ch on the line and lands on it. */
@@ -219,7 +222,7 @@ motionf(struct editor *e, size_t p, int ch, int n)
 	size_t scan, le;
 	int k;
 
-	if (p >= e->buf.len)
+	if (p >= textlen(e))
 		return p;
 
 	scan = p;
@@ -230,13 +233,13 @@ motionf(struct editor *e, size_t p, int ch, int n)
 		size_t found;
 
 		le = lineend(e, scan);
-		start = utfnext(e->buf.s, e->buf.len, scan);
+		start = textnext(e, scan);
 		if (start > le)
 			return p;
 
 		found = le;
 		for (i = start; i < le; i++) {
-			if ((unsigned char)e->buf.s[i] == (unsigned char)ch) {
+			if (textbyte(e, i) == (unsigned char)ch) {
 				found = i;
 				break;
 			}
@@ -255,35 +258,35 @@ motionw(struct editor *e, size_t p)
 {
 	int c, t;
 
-	if (p >= e->buf.len)
+	if (p >= textlen(e))
 		return p;
 
-	c = (unsigned char)e->buf.s[p];
+	c = textbyte(e, p);
 	t = cclass(c);
 
 	if (t == 0) {
-		while (p < e->buf.len) {
-			c = (unsigned char)e->buf.s[p];
+		while (p < textlen(e)) {
+			c = textbyte(e, p);
 			if (cclass(c) != 0)
 				break;
-			p = utfnext(e->buf.s, e->buf.len, p);
+			p = textnext(e, p);
 		}
 		return p;
 	}
 
-	while (p < e->buf.len) {
-		c = (unsigned char)e->buf.s[p];
+	while (p < textlen(e)) {
+		c = textbyte(e, p);
 		if (c == '\n')
 			break;
 		if (cclass(c) != t)
 			break;
-		p = utfnext(e->buf.s, e->buf.len, p);
+		p = textnext(e, p);
 	}
-	while (p < e->buf.len) {
-		c = (unsigned char)e->buf.s[p];
+	while (p < textlen(e)) {
+		c = textbyte(e, p);
 		if (cclass(c) != 0)
 			break;
-		p = utfnext(e->buf.s, e->buf.len, p);
+		p = textnext(e, p);
 	}
 	return p;
 }
@@ -294,14 +297,14 @@ motionb(struct editor *e, size_t p)
 {
 	if (p == 0)
 		return 0;
-	p = utfprev(e->buf.s, e->buf.len, p);
-	while (p > 0 && e->buf.s[p] != '\n' && !isword((unsigned char)e->buf.s[p]))
-		p = utfprev(e->buf.s, e->buf.len, p);
-	while (p > 0 && e->buf.s[p] != '\n' && isword((unsigned char)e->buf.s[p])) {
+	p = textprev(e, p);
+	while (p > 0 && textbyte(e, p) != '\n' && !isword(textbyte(e, p)))
+		p = textprev(e, p);
+	while (p > 0 && textbyte(e, p) != '\n' && isword(textbyte(e, p))) {
 		size_t pp;
 
-		pp = utfprev(e->buf.s, e->buf.len, p);
-		if (!isword((unsigned char)e->buf.s[pp]))
+		pp = textprev(e, p);
+		if (!isword(textbyte(e, pp)))
 			break;
 		p = pp;
 	}
@@ -312,14 +315,14 @@ motionb(struct editor *e, size_t p)
 static size_t
 motione(struct editor *e, size_t p)
 {
-	if (p >= e->buf.len)
+	if (p >= textlen(e))
 		return p;
 	p = motionw(e, p);
-	if (p >= e->buf.len)
+	if (p >= textlen(e))
 		return p;
-	while (p < e->buf.len && e->buf.s[p] != '\n' && isword((unsigned char)e->buf.s[p]))
-		p = utfnext(e->buf.s, e->buf.len, p);
-	return utfprev(e->buf.s, e->buf.len, p);
+	while (p < textlen(e) && textbyte(e, p) != '\n' && isword(textbyte(e, p)))
+		p = textnext(e, p);
+	return textprev(e, p);
 }
 
 /* pairfor maps a delimiter to its opening/closing pair. */
@@ -370,7 +373,7 @@ findinnerpair(struct editor *e, int open, int close, size_t *a, size_t *b)
 	oi = -1;
 	ci = -1;
 
-	if (e->buf.len == 0)
+	if (textlen(e) == 0)
 		return 0;
 
 	if (open == close) {
@@ -380,18 +383,18 @@ findinnerpair(struct editor *e, int open, int close, size_t *a, size_t *b)
 			return 0;
 
 		for (i = e->cur; i > ls; ) {
-			i = utfprev(e->buf.s, e->buf.len, i);
-			if ((unsigned char)e->buf.s[i] == (unsigned char)open) {
+			i = textprev(e, i);
+			if (textbyte(e, i) == (unsigned char)open) {
 				oi = (ssize_t)i;
 				break;
 			}
 		}
 		for (i = e->cur; i < le; ) {
-			if ((unsigned char)e->buf.s[i] == (unsigned char)close) {
+			if (textbyte(e, i) == (unsigned char)close) {
 				ci = (ssize_t)i;
 				break;
 			}
-			i = utfnext(e->buf.s, e->buf.len, i);
+			i = textnext(e, i);
 		}
 		if (oi < 0 || ci < 0 || (size_t)oi >= (size_t)ci)
 			return 0;
@@ -402,12 +405,12 @@ findinnerpair(struct editor *e, int open, int close, size_t *a, size_t *b)
 
 	depth = 0;
 	for (i = e->cur; i > 0; ) {
-		i = utfprev(e->buf.s, e->buf.len, i);
-		if ((unsigned char)e->buf.s[i] == (unsigned char)close) {
+		i = textprev(e, i);
+		if (textbyte(e, i) == (unsigned char)close) {
 			depth++;
 			continue;
 		}
-		if ((unsigned char)e->buf.s[i] == (unsigned char)open) {
+		if (textbyte(e, i) == (unsigned char)open) {
 			if (depth == 0) {
 				oi = (ssize_t)i;
 				break;
@@ -419,22 +422,22 @@ findinnerpair(struct editor *e, int open, int close, size_t *a, size_t *b)
 		return 0;
 
 	depth = 0;
-	for (i = (size_t)oi + 1; i < e->buf.len; ) {
-		if ((unsigned char)e->buf.s[i] == (unsigned char)open) {
+	for (i = (size_t)oi + 1; i < textlen(e); ) {
+		if (textbyte(e, i) == (unsigned char)open) {
 			depth++;
-			i = utfnext(e->buf.s, e->buf.len, i);
+			i = textnext(e, i);
 			continue;
 		}
-		if ((unsigned char)e->buf.s[i] == (unsigned char)close) {
+		if (textbyte(e, i) == (unsigned char)close) {
 			if (depth == 0) {
 				ci = (ssize_t)i;
 				break;
 			}
 			depth--;
-			i = utfnext(e->buf.s, e->buf.len, i);
+			i = textnext(e, i);
 			continue;
 		}
-		i = utfnext(e->buf.s, e->buf.len, i);
+		i = textnext(e, i);
 	}
 	if (ci < 0)
 		return 0;
@@ -486,18 +489,42 @@ yankset(struct editor *e, size_t a, size_t b, bool linewise)
 		a = b;
 		b = t;
 	}
-	if (a > e->buf.len)
-		a = e->buf.len;
-	if (b > e->buf.len)
-		b = e->buf.len;
+	if (a > textlen(e))
+		a = textlen(e);
+	if (b > textlen(e))
+		b = textlen(e);
 
 	n = b - a;
-	sbufsetlen(NULL, &e->yank, 0);
-	if (n)
-		sbufins(NULL, &e->yank, 0, e->buf.s + a, n);
+	sbufsetlen(&e->yank, n);
+	textcopy(e, a, n, e->yank.s);
 	e->yankline = linewise;
 }
 
+/*
+ * bufins inserts n bytes at at, moving a running job's insertion point
+ * along. every edit outside the backends goes through bufins and bufdel.
+ */
+void
+bufins(struct editor *e, size_t at, const void *p, size_t n)
+{
+	if (at > textlen(e))
+		at = textlen(e);
+	jobedit(e, at, n, true);
+	textins(e, at, p, n);
+}
+
+/* bufdel deletes n bytes at at, moving a running job's insertion point along. */
+void
+bufdel(struct editor *e, size_t at, size_t n)
+{
+	if (at >= textlen(e))
+		return;
+	if (n > textlen(e) - at)
+		n = textlen(e) - at;
+	jobedit(e, at, n, false);
+	textdel(e, at, n);
+}
+
 /* bufdelrange deletes bytes in [a,b) from the main buffer and records undo. */
 void
 bufdelrange(struct editor *e, size_t a, size_t b)
@@ -511,19 +538,19 @@ bufdelrange(struct editor *e, size_t a, size_t b)
 		a = b;
 		b = t;
 	}
-	if (a > e->buf.len)
-		a = e->buf.len;
-	if (b > e->buf.len)
-		b = e->buf.len;
+	if (a > textlen(e))
+		a = textlen(e);
+	if (b > textlen(e))
+		b = textlen(e);
 	if (b == a)
 		return;
 
 	cur = e->cur;
 	n = b - a;
-	if (a < e->buf.len)
-		undopushdel(e, a, e->buf.s + a, n, cur);
+	if (a < textlen(e))
+		undopushdel(e, a, n, cur);
 
-	sbufdel(e, &e->buf, a, n);
+	bufdel(e, a, n);
 	e->dirty = true;
 	e->cur = a;
 	clampcur(e);
@@ -537,11 +564,11 @@ bufinsert(struct editor *e, size_t at, const void *p, size_t n)
 
 	if (n == 0)
 		return;
-	if (at > e->buf.len)
-		at = e->buf.len;
+	if (at > textlen(e))
+		at = textlen(e);
 	cur = e->cur;
 	undopushins(e, at, p, n, cur, false);
-	sbufins(e, &e->buf, at, p, n);
+	bufins(e, at, p, n);
 	e->dirty = true;
 }
 
@@ -559,14 +586,14 @@ pasteafter(struct editor *e)
 		size_t le;
 
 		le = lineend(e, e->cur);
-		at = (le < e->buf.len && e->buf.s[le] == '\n') ? le + 1 : le;
+		at = (le < textlen(e) && textbyte(e, le) == '\n') ? le + 1 : le;
 	} else {
-		at = (e->cur < e->buf.len) ? utfnext(e->buf.s, e->buf.len, e->cur) : e->cur;
+		at = (e->cur < textlen(e)) ? textnext(e, e->cur) : e->cur;
 	}
 
 	cur = e->cur;
 	undopushins(e, at, e->yank.s, e->yank.len, cur, false);
-	sbufins(e, &e->buf, at, e->yank.s, e->yank.len);
+	bufins(e, at, e->yank.s, e->yank.len);
 	e->dirty = true;
 	e->cur = at;
 	clampcur(e);
@@ -576,9 +603,9 @@ pasteafter(struct editor *e)
 void
 delchar(struct editor *e)
 {
-	if (e->cur >= e->buf.len)
+	if (e->cur >= textlen(e))
 		return;
-	bufdelrange(e, e->cur, utfnext(e->buf.s, e->buf.len, e->cur));
+	bufdelrange(e, e->cur, textnext(e, e->cur));
 }
 
 /* openbelow inserts a newline after the current line and enters insert mode. */
@@ -591,11 +618,11 @@ openbelow(struct editor *e)
 	size_t cur;
 
 	le = lineend(e, e->cur);
-	at = (le < e->buf.len && e->buf.s[le] == '\n') ? le + 1 : le;
+	at = (le < textlen(e) && textbyte(e, le) == '\n') ? le + 1 : le;
 	nl = '\n';
 	cur = e->cur;
 	undopushins(e, at, &nl, 1, cur, false);
-	sbufins(e, &e->buf, at, &nl, 1);
+	bufins(e, at, &nl, 1);
 	e->dirty = true;
 	e->cur = at;
 	enterinsert(e);
@@ -613,7 +640,7 @@ openabove(struct editor *e)
 	nl = '\n';
 	cur = e->cur;
 	undopushins(e, ls, &nl, 1, cur, false);
-	sbufins(e, &e->buf, ls, &nl, 1);
+	bufins(e, ls, &nl, 1);
 	e->dirty = true;
 	e->cur = ls;
 	enterinsert(e);
@@ -627,7 +654,7 @@ backspace(struct editor *e)
 
 	if (e->cur == 0)
 		return;
-	p = utfprev(e->buf.s, e->buf.len, e->cur);
+	p = textprev(e, e->cur);
 	bufdelrange(e, p, e->cur);
 }
 
@@ -641,7 +668,7 @@ insbyte(struct editor *e, int c)
 	ch = (char)c;
 	cur = e->cur;
 	undopushins(e, e->cur, &ch, 1, cur, true);
-	sbufins(e, &e->buf, e->cur, &ch, 1);
+	bufins(e, e->cur, &ch, 1);
 	e->cur++;
 	e->dirty = true;
 }
@@ -656,7 +683,7 @@ insnl(struct editor *e)
 	c = '\n';
 	cur = e->cur;
 	undopushins(e, e->cur, &c, 1, cur, true);
-	sbufins(e, &e->buf, e->cur, &c, 1);
+	bufins(e, e->cur, &c, 1);
 	e->cur++;
 	e->dirty = true;
 }
@@ -704,7 +731,7 @@ applymotion(struct editor *e, int key)
 		}
 	} else if (key == 'G') {
 		if (e->count)
-			end = row2off(e, e->count - 1);
+			end = row2off(e, (size_t)e->count - 1);
 		else
 			end = motioncapg(e, e->cur);
 	} else if (key == 't') {
@@ -764,20 +791,20 @@ applymotion(struct editor *e, int key)
 	}
 
 	if (e->op == 'd' || e->op == 'c') {
-		if (key == 'e' && end < e->buf.len)
-			end = utfnext(e->buf.s, e->buf.len, end);
-		if (key == 'f' && end < e->buf.len)
-			end = utfnext(e->buf.s, e->buf.len, end);
+		if (key == 'e' && end < textlen(e))
+			end = textnext(e, end);
+		if (key == 'f' && end < textlen(e))
+			end = textnext(e, end);
 		linewise = false;
 		yankset(e, start, end, linewise);
 		bufdelrange(e, start, end);
 		if (e->op == 'c')
 			enterinsert(e);
 	} else if (e->op == 'y') {
-		if (key == 'e' && end < e->buf.len)
-			end = utfnext(e->buf.s, e->buf.len, end);
-		if (key == 'f' && end < e->buf.len)
-			end = utfnext(e->buf.s, e->buf.len, end);
+		if (key == 'e' && end < textlen(e))
+			end = textnext(e, end);
+		if (key == 'f' && end < textlen(e))
+			end = textnext(e, end);
 		yankset(e, start, end, linewise);
 		setstatus(e, "yanked %zu bytes", e->yank.len);
 	}
@@ -15,6 +15,12 @@ int visrange(struct editor *e, size_t *a, size_t *b);
 /* yankset copies [a,b) into the yank buffer (optionally linewise). */
 void yankset(struct editor *e, size_t a, size_t b, bool linewise);
 
+/* bufins inserts n bytes at at, moving a running job's insertion point along. */
+void bufins(struct editor *e, size_t at, const void *p, size_t n);
+
+/* bufdel deletes n bytes at at, moving a running job's insertion point along. */
+void bufdel(struct editor *e, size_t at, size_t n);
+
 /* bufdelrange deletes bytes in [a,b) from the main buffer and records undo. */
 void bufdelrange(struct editor *e, size_t a, size_t b);
 
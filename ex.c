@@ -2,11 +2,13 @@
 
 #include "edit.h"
 #include "file.h"
+#include "find.h"
+#include "job.h"
 #include "lines.h"
 #include "sbuf.h"
 #include "status.h"
 #include "term.h"
-#include "utf.h"
+#include "text.h"
 
 /*
  * ex/search.
@@ -29,7 +31,7 @@ parsepat(const char *s, size_t slen, struct sbuf *out, int *a0, int *a1)
 	int esc;
 	bool lastesc;
 
-	sbufsetlen(NULL, out, 0);
+	sbufsetlen(out, 0);
 	if (a0)
 		*a0 = 0;
 	if (a1)
@@ -56,152 +58,36 @@ parsepat(const char *s, size_t slen, struct sbuf *out, int *a0, int *a1)
 			*a0 = 1;
 			continue;
 		}
-		sbufins(NULL, out, out->len, &c, 1);
+		sbufins(out, out->len, &c, 1);
 	}
 
 	if (a1 && out->len && out->s[out->len - 1] == '$' && !lastesc) {
 		*a1 = 1;
-		sbufsetlen(NULL, out, out->len - 1);
+		sbufsetlen(out, out->len - 1);
 	}
 }
 
-/*
- * runstdout runs cmd via a shell and captures its stdout.
- * returns: 0 on success, -1 on failure.
- */
-static int
-runstdout(const char *cmd, struct sbuf *out, int *ws)
-{
-	int pfd[2];
-	pid_t pid;
-	int st;
-	char buf[4096];
-	ssize_t n;
-	int in, err;
-
-	if (ws)
-		*ws = 0;
-	sbufsetlen(NULL, out, 0);
-
-	if (pipe(pfd) == -1)
-		return -1;
-
-	pid = fork();
-	if (pid == -1) {
-		close(pfd[0]);
-		close(pfd[1]);
-		return -1;
-	}
-
-	if (pid == 0) {
-		in = open("/dev/null", O_RDONLY);
-		if (in >= 0) {
-			dup2(in, STDIN_FILENO);
-			close(in);
-		}
-		dup2(pfd[1], STDOUT_FILENO);
-		close(pfd[0]);
-		close(pfd[1]);
-
-		err = open("/dev/null", O_WRONLY);
-		if (err >= 0) {
-			dup2(err, STDERR_FILENO);
-			close(err);
-		}
-
-		execl("/bin/bash", "bash", "-c", cmd, (char *)NULL);
-		execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
-		_exit(127);
-	}
-
-	close(pfd[1]);
-	for (;;) {
-		n = read(pfd[0], buf, sizeof(buf));
-		if (n > 0) {
-			sbufins(NULL, out, out->len, buf, (size_t)n);
-			continue;
-		}
-		if (n == 0)
-			break;
-		if (errno == EINTR)
-			continue;
-		close(pfd[0]);
-		(void)waitpid(pid, NULL, 0);
-		return -1;
-	}
-	close(pfd[0]);
-
-	st = 0;
-	if (waitpid(pid, &st, 0) == -1)
-		return -1;
-	if (ws)
-		*ws = st;
-	return 0;
-}
-
-/* findnext searches forward for a literal pat. */
+/* findnext searches forward in [start,slen) of the buffer for a literal pat. */
 static int
-findnext(const char *s, size_t slen, const char *pat, size_t plen, size_t start, size_t *pos)
+findnext(struct editor *e, size_t slen, const char *pat, size_t plen, size_t start, size_t *pos)
 {
-	size_t i;
-
-	if (plen == 0)
-		return 0;
-	if (start > slen)
-		return 0;
-	if (plen > slen)
-		return 0;
-
-	for (i = start; i + plen <= slen; i++) {
-		if (memcmp(s + i, pat, plen) == 0) {
-			*pos = i;
-			return 1;
-		}
-	}
-	return 0;
+	return findlit(e, pat, plen, start, slen, pos);
 }
 
-/* findprev searches backward for a literal pat. */
+/* findprev searches backward from before for a literal pat. */
 static int
-findprev(const char *s, size_t slen, const char *pat, size_t plen, size_t before, size_t *pos)
+findprev(struct editor *e, const char *pat, size_t plen, size_t before, size_t *pos)
 {
-	size_t i;
-	size_t last;
-	int found;
-
-	if (plen == 0)
-		return 0;
-	if (before > slen)
-		before = slen;
-	if (plen > slen)
-		return 0;
-
-	found = 0;
-	last = 0;
-	for (i = 0; i + plen <= before; i++) {
-		if (memcmp(s + i, pat, plen) == 0) {
-			last = i;
-			found = 1;
-		}
-	}
-	if (!found)
-		return 0;
-	*pos = last;
-	return 1;
+	return findlitrev(e, pat, plen, 0, before, pos);
 }
 
 /* prevlinestart returns the start offset of the previous line. */
 static size_t
 prevlinestart(struct editor *e, size_t ls)
 {
-	size_t i;
-
 	if (ls == 0)
 		return 0;
-	i = ls - 1;
-	while (i > 0 && e->buf.s[i - 1] != '\n')
-		i--;
-	return i;
+	return linestart(e, ls - 1);
 }
 
 /* findanchnext searches forward for an anchored match. */
@@ -210,12 +96,12 @@ findanchnext(struct editor *e, const char *pat, size_t plen, int a0, int a1, siz
 {
 	size_t ls, le;
 
-	if (start > e->buf.len)
+	if (start > textlen(e))
 		return 0;
 	ls = linestart(e, start);
 	if (start != ls) {
 		le = lineend(e, start);
-		if (le < e->buf.len && e->buf.s[le] == '\n')
+		if (le < textlen(e) && textbyte(e, le) == '\n')
 			ls = le + 1;
 		else
 			return 0;
@@ -224,7 +110,7 @@ findanchnext(struct editor *e, const char *pat, size_t plen, int a0, int a1, siz
 	for (;;) {
 		size_t cand;
 
-		if (ls > e->buf.len)
+		if (ls > textlen(e))
 			break;
 		le = lineend(e, ls);
 		cand = ls;
@@ -256,13 +142,13 @@ findanchnext(struct editor *e, const char *pat, size_t plen, int a0, int a1, siz
 			goto next;
 		if (a1 && cand + plen != le)
 			goto next;
-		if (memcmp(e->buf.s + cand, pat, plen) == 0) {
+		if (textmatch(e, cand, pat, plen)) {
 			*pos = cand;
 			return 1;
 		}
 
 next:
-		if (le < e->buf.len && e->buf.s[le] == '\n') {
+		if (le < textlen(e) && textbyte(e, le) == '\n') {
 			ls = le + 1;
 			continue;
 		}
@@ -277,10 +163,10 @@ findanchnextrange(struct editor *e, const char *pat, size_t plen, int a0, int a1
 {
 	size_t ls, le;
 
-	if (rs > e->buf.len)
-		rs = e->buf.len;
-	if (re > e->buf.len)
-		re = e->buf.len;
+	if (rs > textlen(e))
+		rs = textlen(e);
+	if (re > textlen(e))
+		re = textlen(e);
 	if (re < rs) {
 		size_t t = rs;
 
@@ -295,7 +181,7 @@ findanchnextrange(struct editor *e, const char *pat, size_t plen, int a0, int a1
 	ls = linestart(e, start);
 	if (start != ls) {
 		le = lineend(e, start);
-		if (le < e->buf.len && e->buf.s[le] == '\n')
+		if (le < textlen(e) && textbyte(e, le) == '\n')
 			ls = le + 1;
 		else
 			return 0;
@@ -342,13 +228,13 @@ findanchnextrange(struct editor *e, const char *pat, size_t plen, int a0, int a1
 			goto next;
 		if (a1 && cand + plen != le)
 			goto next;
-		if (memcmp(e->buf.s + cand, pat, plen) == 0) {
+		if (textmatch(e, cand, pat, plen)) {
 			*pos = cand;
 			return 1;
 		}
 
 next:
-		if (le < e->buf.len && e->buf.s[le] == '\n') {
+		if (le < textlen(e) && textbyte(e, le) == '\n') {
 			ls = le + 1;
 			continue;
 		}
@@ -362,53 +248,44 @@ static int
 findanchprev(struct editor *e, const char *pat, size_t plen, int a0, int a1, size_t before, size_t *pos)
 {
 	size_t ls, le;
-	size_t cand;
+	size_t m;
+
+	if (before > textlen(e))
+		before = textlen(e);
+
+	if (plen > 0) {
+		/* walk back over the literal hits until one sits at the anchors. */
+		while (findlitrev(e, pat, plen, 0, before, &m)) {
+			ls = linestart(e, m);
+			le = lineend(e, m);
+			if (m + plen <= le && (!a0 || m == ls) && (!a1 || m + plen == le)) {
+				*pos = m;
+				return 1;
+			}
+			before = m + plen - 1;
+		}
+		return 0;
+	}
 
-	if (before > e->buf.len)
-		before = e->buf.len;
 	ls = linestart(e, before);
-
 	for (;;) {
 		le = lineend(e, ls);
-		cand = ls;
-		if (!a0 && a1) {
-			if (le < plen)
-				goto prev;
-			cand = le - plen;
-		}
-		if (plen == 0) {
-			if (a0 && a1) {
-				if (ls == le && ls <= before) {
-					*pos = ls;
-					return 1;
-				}
-			} else if (a0) {
-				if (ls <= before) {
-					*pos = ls;
-					return 1;
-				}
-			} else if (a1) {
-				if (le <= before) {
-					*pos = le;
-					return 1;
-				}
+		if (a0 && a1) {
+			if (ls == le && ls <= before) {
+				*pos = ls;
+				return 1;
+			}
+		} else if (a0) {
+			if (ls <= before) {
+				*pos = ls;
+				return 1;
+			}
+		} else if (a1) {
+			if (le <= before) {
+				*pos = le;
+				return 1;
 			}
-			goto prev;
-		}
-		if (cand + plen > le)
-			goto prev;
-		if (a0 && cand != ls)
-			goto prev;
-		if (a1 && cand + plen != le)
-			goto prev;
-		if (cand + plen > before)
-			goto prev;
-		if (memcmp(e->buf.s + cand, pat, plen) == 0) {
-			*pos = cand;
-			return 1;
 		}
-
-prev:
 		if (ls == 0)
 			break;
 		ls = prevlinestart(e, ls);
@@ -427,8 +304,8 @@ searchdo(struct editor *e, int dir)
 
 	if (e->cmdpre == '/') {
 		if (e->cmd.len) {
-			sbufsetlen(NULL, &e->search, 0);
-			sbufins(NULL, &e->search, 0, e->cmd.s, e->cmd.len);
+			sbufsetlen(&e->search, 0);
+			sbufins(&e->search, 0, e->cmd.s, e->cmd.len);
 		}
 	}
 
@@ -440,25 +317,25 @@ searchdo(struct editor *e, int dir)
 	parsepat(e->search.s, e->search.len, &pat, &a0, &a1);
 
 	if (dir >= 0) {
-		start = (e->cur < e->buf.len) ? utfnext(e->buf.s, e->buf.len, e->cur) : e->cur;
+		start = (e->cur < textlen(e)) ? textnext(e, e->cur) : e->cur;
 		if ((a0 || a1) ? !findanchnext(e, pat.s, pat.len, a0, a1, start, &pos)
-		              : !findnext(e->buf.s, e->buf.len, pat.s, pat.len, start, &pos)) {
+		              : !findnext(e, textlen(e), pat.s, pat.len, start, &pos)) {
 			setstatus(e, "pattern not found");
-			sbuffree(NULL, &pat);
+			sbuffree(&pat);
 			return;
 		}
 	} else {
 		start = e->cur;
 		if (start > 0)
-			start = utfprev(e->buf.s, e->buf.len, start);
+			start = textprev(e, start);
 		if ((a0 || a1) ? !findanchprev(e, pat.s, pat.len, a0, a1, start, &pos)
-		              : !findprev(e->buf.s, e->buf.len, pat.s, pat.len, start, &pos)) {
+		              : !findprev(e, pat.s, pat.len, start, &pos)) {
 			setstatus(e, "pattern not found");
-			sbuffree(NULL, &pat);
+			sbuffree(&pat);
 			return;
 		}
 	}
-	sbuffree(NULL, &pat);
+	sbuffree(&pat);
 
 	e->cur = pos;
 	clampcur(e);
@@ -474,17 +351,17 @@ skips(const char *p)
 	return p;
 }
 
-/* addrfindline implements /literal/ address lookup from row startrow. */
-static int
-addrfindline(struct editor *e, const char *s, size_t n, int startrow)
+/* addrfindline implements /literal/ address lookup from row startrow (0 if not found). */
+static size_t
+addrfindline(struct editor *e, const char *s, size_t n, size_t startrow)
 {
 	size_t start;
 	size_t pos;
-	int row;
-	int lcount;
+	size_t row;
+	size_t lcount;
 
 	if (n == 0)
-		return -1;
+		return 0;
 	if (startrow < 1)
 		startrow = 1;
 	lcount = linecount(e);
@@ -492,50 +369,51 @@ addrfindline(struct editor *e, const char *s, size_t n, int startrow)
 		startrow = lcount;
 
 	start = row2off(e, startrow - 1);
-	if (findnext(e->buf.s, e->buf.len, s, n, start, &pos)) {
+	if (findnext(e, textlen(e), s, n, start, &pos)) {
 		row = off2row(e, pos) + 1;
 		return row;
 	}
-	if (start > 0 && findnext(e->buf.s, e->buf.len, s, n, 0, &pos)) {
+	if (start > 0 && findnext(e, textlen(e), s, n, 0, &pos)) {
 		row = off2row(e, pos) + 1;
 		return row;
 	}
-	return -1;
+	return 0;
 }
 
 /* parseaddr parses a single ex address and returns 1 on success. */
 static int
-parseaddr(struct editor *e, const char **pp, int *outrow)
+parseaddr(struct editor *e, const char **pp, size_t *outrow)
 {
 	const char *p;
-	int base;
-	int lcount;
+	size_t base;
+	size_t lcount;
+	bool has;
 
 	p = skips(*pp);
-	base = -1;
+	base = 0;
+	has = false;
 	lcount = linecount(e);
 
 	if (*p == '.') {
 		base = off2row(e, e->cur) + 1;
+		has = true;
 		p++;
 	} else if (*p == '$') {
 		base = lcount;
+		has = true;
 		p++;
 	} else if (isdigit((unsigned char)*p)) {
-		long v;
-
-		v = 0;
+		/* numbers past the last line saturate instead of overflowing. */
 		while (isdigit((unsigned char)*p)) {
-			v = v * 10 + (*p - '0');
+			if (base <= lcount)
+				base = base * 10 + (size_t)(*p - '0');
 			p++;
-			if (v > 1000000)
-				break;
 		}
-		base = (int)v;
+		has = true;
 	} else if (*p == '/') {
 		size_t i;
 		struct sbuf lit = {0};
-		int found;
+		size_t found;
 
 		p++;
 		for (i = 0; p[i]; i++) {
@@ -544,31 +422,32 @@ parseaddr(struct editor *e, const char **pp, int *outrow)
 			c = p[i];
 			if (c == '\\' && p[i + 1]) {
 				i++;
-				sbufins(NULL, &lit, lit.len, &p[i], 1);
+				sbufins(&lit, lit.len, &p[i], 1);
 				continue;
 			}
 			if (c == '/')
 				break;
-			sbufins(NULL, &lit, lit.len, &c, 1);
+			sbufins(&lit, lit.len, &c, 1);
 		}
 		if (p[i] != '/') {
-			sbuffree(NULL, &lit);
+			sbuffree(&lit);
 			return 0;
 		}
 		found = addrfindline(e, lit.s, lit.len, off2row(e, e->cur) + 1);
-		sbuffree(NULL, &lit);
-		if (found < 0)
+		sbuffree(&lit);
+		if (found == 0)
 			return 0;
 		base = found;
+		has = true;
 		p += i + 1;
 	}
 
-	if (base < 0)
+	if (!has)
 		return 0;
 
 	for (;;) {
 		int sign;
-		int n;
+		size_t n;
 
 		p = skips(p);
 		sign = 0;
@@ -586,12 +465,14 @@ parseaddr(struct editor *e, const char **pp, int *outrow)
 		if (!isdigit((unsigned char)*p))
 			n = 1;
 		while (isdigit((unsigned char)*p)) {
-			n = n * 10 + (*p - '0');
+			if (n <= lcount)
+				n = n * 10 + (size_t)(*p - '0');
 			p++;
-			if (n > 1000000)
-				break;
 		}
-		base += sign * n;
+		if (sign > 0)
+			base = n <= lcount ? base + n : lcount;
+		else
+			base = n < base ? base - n : 0;
 	}
 
 	if (base < 1)
@@ -604,12 +485,12 @@ parseaddr(struct editor *e, const char **pp, int *outrow)
 	return 1;
 }
 
-/* parsesubex parses an optional range prefix for "s" commands. */
+/* parserange parses an optional range prefix, leaving *sub on the command letter (2 range, 1 none, 0 bad). */
 static int
-parsesubex(struct editor *e, const char *cmd, const char **sub, int *r0, int *r1)
+parserange(struct editor *e, const char *cmd, const char **sub, size_t *r0, size_t *r1)
 {
 	const char *p;
-	int a0, a1;
+	size_t a0, a1;
 	int has0, has1;
 
 	p = skips(cmd);
@@ -639,9 +520,6 @@ parsesubex(struct editor *e, const char *cmd, const char **sub, int *r0, int *r1
 	}
 
 	p = skips(p);
-	if (*p != 's')
-		return 0;
-
 	*sub = p;
 	if (has0 && has1) {
 		*r0 = a0;
@@ -698,11 +576,11 @@ subcmd(struct editor *e, const char *cmd, size_t rs, size_t re, int hasrange)
 				break;
 			if (!esc && c == '\\' && cmd[i + 1]) {
 				esc = 1;
-				sbufins(NULL, &raw, raw.len, &c, 1);
+				sbufins(&raw, raw.len, &c, 1);
 				continue;
 			}
 			esc = 0;
-			sbufins(NULL, &raw, raw.len, &c, 1);
+			sbufins(&raw, raw.len, &c, 1);
 		}
 		if (cmd[i] != delim) {
 			setstatus(e, "bad substitute");
@@ -722,12 +600,12 @@ subcmd(struct editor *e, const char *cmd, size_t rs, size_t re, int hasrange)
 		c = cmd[i];
 		if (c == '\\' && cmd[i + 1]) {
 			i++;
-			sbufins(NULL, &rep, rep.len, &cmd[i], 1);
+			sbufins(&rep, rep.len, &cmd[i], 1);
 			continue;
 		}
 		if (c == delim)
 			break;
-		sbufins(NULL, &rep, rep.len, &c, 1);
+		sbufins(&rep, rep.len, &c, 1);
 	}
 	if (cmd[i] == delim)
 		i++;
@@ -742,10 +620,10 @@ subcmd(struct editor *e, const char *cmd, size_t rs, size_t re, int hasrange)
 	} else {
 		rangestart = rs;
 		rangeend = re;
-		if (rangestart > e->buf.len)
-			rangestart = e->buf.len;
-		if (rangeend > e->buf.len)
-			rangeend = e->buf.len;
+		if (rangestart > textlen(e))
+			rangestart = textlen(e);
+		if (rangeend > textlen(e))
+			rangeend = textlen(e);
 		if (rangeend < rangestart) {
 			size_t t;
 
@@ -778,7 +656,7 @@ subcmd(struct editor *e, const char *cmd, size_t rs, size_t re, int hasrange)
 				if ((a0 || a1))
 					ok = findanchnextrange(e, pat.s, pat.len, a0, a1, pos, ls, le, &m);
 				else
-					ok = findnext(e->buf.s, le, pat.s, pat.len, pos, &m);
+					ok = findnext(e, le, pat.s, pat.len, pos, &m);
 				if (!ok)
 					break;
 				if (m + pat.len > le)
@@ -806,7 +684,7 @@ subcmd(struct editor *e, const char *cmd, size_t rs, size_t re, int hasrange)
 			}
 
 			le = lineend(e, ls);
-			if (le < e->buf.len && e->buf.s[le] == '\n') {
+			if (le < textlen(e) && textbyte(e, le) == '\n') {
 				ls = le + 1;
 				continue;
 			}
@@ -823,9 +701,9 @@ subcmd(struct editor *e, const char *cmd, size_t rs, size_t re, int hasrange)
 	}
 
 out:
-	sbuffree(NULL, &raw);
-	sbuffree(NULL, &pat);
-	sbuffree(NULL, &rep);
+	sbuffree(&raw);
+	sbuffree(&pat);
+	sbuffree(&rep);
 }
 
 /* cmdexec runs the current cmdline (':' or '/' prompt). */
@@ -877,14 +755,15 @@ cmdexec(struct editor *e)
 	}
 	{
 		const char *sub;
-		int r0, r1;
+		size_t r0, r1;
 		int kind;
 
+		/* parsed once: a /pat/ address searches, and both commands below take a range. */
 		sub = NULL;
 		r0 = 0;
 		r1 = 0;
-		kind = parsesubex(e, e->cmd.s, &sub, &r0, &r1);
-		if (kind) {
+		kind = parserange(e, e->cmd.s, &sub, &r0, &r1);
+		if (kind && *sub == 's') {
 			if (kind == 2) {
 				size_t a, b;
 
@@ -898,7 +777,7 @@ cmdexec(struct editor *e)
 			}
 			if (e->prevmode == mvisual) {
 				size_t a, b;
-				int sa, sb;
+				size_t sa, sb;
 
 				if (visrange(e, &a, &b)) {
 					sa = off2row(e, linestart(e, a)) + 1;
@@ -915,13 +794,48 @@ cmdexec(struct editor *e)
 			e->mode = mnormal;
 			return;
 		}
+		if (kind && *sub == '!') {
+			const char *cmd;
+			size_t a, b;
+
+			cmd = skips(sub + 1);
+			if (kind == 1 && e->prevmode == mvisual && visrange(e, &a, &b)) {
+				r0 = off2row(e, linestart(e, a)) + 1;
+				r1 = off2row(e, linestart(e, b)) + 1;
+				kind = 2;
+			}
+			if (kind == 1 || *cmd == 0) {
+				setstatus(e, "usage: :{range}!cmd");
+				e->mode = e->prevmode;
+				return;
+			}
+			if (e->job) {
+				setstatus(e, "filter: a job is running");
+				e->mode = e->prevmode;
+				return;
+			}
+			if (r0 > r1) {
+				size_t t;
+
+				t = r0;
+				r0 = r1;
+				r1 = t;
+			}
+			a = row2off(e, r0 - 1);
+			b = lineend(e, row2off(e, r1 - 1));
+			if (b < textlen(e))
+				b++;
+			if (e->prevmode == mvisual)
+				visoff(e);
+			e->mode = mnormal;
+			if (jobfilter(e, cmd, a, b) == -1)
+				setstatus(e, "filter failed");
+			return;
+		}
 	}
 	if (!strncmp(e->cmd.s, "run", 3) && (e->cmd.s[3] == 0 || isspace((unsigned char)e->cmd.s[3]))) {
 		const char *p;
-		struct sbuf out = {0};
 		size_t at;
-		size_t nbytes;
-		int st;
 
 		p = e->cmd.s + 3;
 		while (*p == ' ' || *p == '\t')
@@ -931,27 +845,21 @@ cmdexec(struct editor *e)
 			e->mode = e->prevmode;
 			return;
 		}
-		if (runstdout(p, &out, &st) == -1) {
-			setstatus(e, "run failed");
+		if (e->job) {
+			setstatus(e, "run: a job is already running");
 			e->mode = e->prevmode;
-			sbuffree(NULL, &out);
 			return;
 		}
-		if (out.len == 0) {
-			setstatus(e, "run: no output");
+		at = (e->cur < textlen(e)) ? textnext(e, e->cur) : e->cur;
+		if (jobstart(e, p, at) == -1) {
+			setstatus(e, "run failed");
 			e->mode = e->prevmode;
-			sbuffree(NULL, &out);
 			return;
 		}
-
-		at = (e->cur < e->buf.len) ? utfnext(e->buf.s, e->buf.len, e->cur) : e->cur;
-		bufinsert(e, at, out.s, out.len);
-		nbytes = out.len;
-		sbuffree(NULL, &out);
 		if (e->prevmode == mvisual)
 			visoff(e);
 		e->mode = mnormal;
-		setstatus(e, "run: %zu bytes", nbytes);
+		setstatus(e, "run: started (Ctrl-C stops it)");
 		return;
 	}
 	if (!strcmp(e->cmd.s, "q")) {
@@ -2,6 +2,7 @@
 
 #include "sbuf.h"
 #include "status.h"
+#include "text.h"
 #include "undo.h"
 #include "wee_util.h"
 
@@ -16,7 +17,7 @@ void
 filenew(struct editor *e)
 {
 	undoclear(e);
-	sbufsetlen(e, &e->buf, 0);
+	textclear(e);
 	e->cur = 0;
 	e->dirty = false;
 	e->rowoff = 0;
@@ -43,8 +44,7 @@ fileopen(struct editor *e, const char *path)
 		die("bad file size");
 
 	n = (size_t)st.st_size;
-	sbufsetlen(e, &e->buf, n);
-	if (n && read(fd, e->buf.s, n) != (ssize_t)n)
+	if (textload(e, fd, n) == -1)
 		die("read file: %s", strerror(errno));
 	close(fd);
 
@@ -60,7 +60,7 @@ void
 filesave(struct editor *e)
 {
 	int fd;
-	ssize_t n;
+	size_t at;
 	char *tmp;
 
 	if (!e->filename) {
@@ -80,13 +80,23 @@ filesave(struct editor *e)
 		return;
 	}
 
-	n = write(fd, e->buf.s, e->buf.len);
-	if (n == -1 || (size_t)n != e->buf.len) {
-		close(fd);
-		unlink(tmp);
-		free(tmp);
-		setstatus(e, "write failed: %s", strerror(errno));
-		return;
+	for (at = 0; at < textlen(e); ) {
+		const char *s;
+		size_t k;
+		ssize_t n;
+
+		s = textspan(e, at, &k);
+		n = write(fd, s, k);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			close(fd);
+			unlink(tmp);
+			free(tmp);
+			setstatus(e, "write failed: %s", strerror(errno));
+			return;
+		}
+		at += (size_t)n;
 	}
 
 	if (fsync(fd) == -1) {
@@ -107,5 +117,5 @@ filesave(struct editor *e)
 	free(tmp);
 
 	e->dirty = false;
-	setstatus(e, "%zu bytes written", e->buf.len);
+	setstatus(e, "%zu bytes written", textlen(e));
 }
@@ -0,0 +1,391 @@
+#include "find.h"
+
+#include "sbuf.h"
+#include "text.h"
+
+/*
+ * literal search.
+ *
+ * looks for a byte string without a textmatch per offset. each text
+ * span is searched in place: memchr runs ahead to the pattern's rarest
+ * byte and the candidates it finds are checked with memcmp. when too
+ * many candidates turn out false, the rest of the span is handed to
+ * Two-Way, which skips on the window's last byte (Horspool) and never
+ * backs up more than the pattern's critical factorisation allows.
+ * matches straddling two spans are looked for in a small copied window.
+ * the preprocessed pattern is kept between calls, so n/N, :s and
+ * /addr/ lookups with the same pattern skip the setup.
+ *
+ * backward searches mirror all of this: the prefilter scans towards
+ * the start and Two-Way runs over the reversed pattern. the text is
+ * taken in blocks walking back from the end of the range (spans only
+ * run forward), growing while nothing turns up, so a hit close by
+ * costs little however long the text is.
+ */
+
+enum {
+	findslack = 8, /* false prefilter hits forgiven before Two-Way takes over */
+	findblk = 1 << 16, /* first block a backward search looks at */
+	findblkmax = 1 << 24, /* the most it grows to */
+};
+
+/* Two-Way tables for one reading direction of the pattern. */
+struct tw {
+	size_t ms; /* split: p[0..ms] and p[ms+1..] */
+	size_t per; /* shift after the right half matched but the left did not */
+	size_t mem0; /* bytes known to match after that shift (periodic p) */
+	size_t skip[256]; /* distance from a byte's last occurrence to the end */
+};
+
+struct finder {
+	struct sbuf pat;
+	struct sbuf rpat; /* pat reversed, for backward searches */
+	size_t rare; /* index of the byte memchr runs ahead to */
+	struct tw fw, bw;
+	struct sbuf win; /* bytes around a span boundary */
+	bool ready;
+};
+
+static struct finder fcache;
+
+/* byterank guesses how common c is in text (higher is more common). */
+static int
+byterank(unsigned char c)
+{
+	static const char common[] = " etaoinsrhldcumfpgwybv,.k\n0x1-_=2j()q3;z\"/:'45\t9876";
+	const char *p;
+
+	if (c && (p = strchr(common, c)))
+		return 200 - (int)(p - common);
+	if (isupper(c))
+		return 60;
+	if (isprint(c))
+		return 40;
+	if (c >= 0x80)
+		return 30;
+	return 10;
+}
+
+/* maxsuf computes the maximal suffix of p under < (rev false) or > (rev true). */
+static size_t
+maxsuf(const unsigned char *p, size_t n, bool rev, size_t *per)
+{
+	size_t i, j, k;
+
+	/* i starts at -1: the suffix begins at i+1. */
+	i = (size_t)-1;
+	j = 0;
+	k = 1;
+	*per = 1;
+	while (j + k < n) {
+		unsigned char a, b;
+
+		a = p[i + k];
+		b = p[j + k];
+		if (a == b) {
+			if (k == *per) {
+				j += *per;
+				k = 1;
+			} else {
+				k++;
+			}
+		} else if (rev ? a < b : a > b) {
+			j += k;
+			k = 1;
+			*per = j - i;
+		} else {
+			i = j++;
+			k = *per = 1;
+		}
+	}
+	return i;
+}
+
+/* twprep fills t for the l-byte pattern p. */
+static void
+twprep(struct tw *t, const unsigned char *p, size_t l)
+{
+	size_t i, ms, ms2, per, per2;
+
+	for (i = 0; i < 256; i++)
+		t->skip[i] = l;
+	for (i = 0; i < l; i++)
+		t->skip[p[i]] = l - 1 - i;
+
+	/* critical factorisation: the later of the two maximal suffixes. */
+	ms = maxsuf(p, l, false, &per);
+	ms2 = maxsuf(p, l, true, &per2);
+	if (ms2 + 1 > ms + 1) {
+		ms = ms2;
+		per = per2;
+	}
+	t->ms = ms;
+	if (memcmp(p, p + per, ms + 1)) {
+		t->per = (ms > l - ms - 1 ? ms : l - ms - 1) + 1;
+		t->mem0 = 0;
+	} else {
+		t->per = per;
+		t->mem0 = l - per;
+	}
+}
+
+/* finderfor returns the preprocessed form of pat, reusing the last one when it matches. */
+static struct finder *
+finderfor(const char *pat, size_t plen)
+{
+	const unsigned char *p;
+	size_t i;
+
+	if (fcache.ready && fcache.pat.len == plen && !memcmp(fcache.pat.s, pat, plen))
+		return &fcache;
+	sbufsetlen(&fcache.pat, 0);
+	sbufins(&fcache.pat, 0, pat, plen);
+	sbufsetlen(&fcache.rpat, plen);
+	for (i = 0; i < plen; i++)
+		fcache.rpat.s[i] = pat[plen - 1 - i];
+	p = (const unsigned char *)fcache.pat.s;
+
+	fcache.rare = 0;
+	for (i = 1; i < plen; i++) {
+		if (byterank(p[i]) < byterank(p[fcache.rare]))
+			fcache.rare = i;
+	}
+	twprep(&fcache.fw, p, plen);
+	twprep(&fcache.bw, (const unsigned char *)fcache.rpat.s, plen);
+	fcache.ready = true;
+	return &fcache;
+}
+
+/*
+ * twoway runs Two-Way over n haystack bytes read from h with stride d
+ * (1 forwards; -1 backwards from h, with p reversed). it returns how
+ * many bytes precede the first match in that reading order, or -1.
+ */
+static size_t
+twoway(const struct tw *t, const char *pat, size_t l, const char *h, size_t n, int d)
+{
+	const unsigned char *p, *s;
+	size_t at, k, mem;
+
+	p = (const unsigned char *)pat;
+	s = (const unsigned char *)h;
+#define HB(i) s[(ptrdiff_t)(i) * d]
+	at = 0;
+	mem = 0;
+	while (n - at >= l) {
+		k = t->skip[HB(at + l - 1)];
+		if (k) {
+			at += k;
+			mem = 0;
+			continue;
+		}
+		k = (t->ms + 1 > mem) ? t->ms + 1 : mem;
+		while (k < l && p[k] == HB(at + k))
+			k++;
+		if (k < l) {
+			at += k - t->ms;
+			mem = 0;
+			continue;
+		}
+		k = t->ms + 1;
+		while (k > mem && p[k - 1] == HB(at + k - 1))
+			k--;
+		if (k <= mem)
+			return at;
+		at += t->per;
+		mem = t->mem0;
+	}
+#undef HB
+	return (size_t)-1;
+}
+
+/* rchr finds the last c in h[0..n) (NULL if none), a word at a time. */
+static const char *
+rchr(const char *h, int c, size_t n)
+{
+	const uint64_t ones = 0x0101010101010101ull;
+	uint64_t pat, w;
+
+	pat = ones * (unsigned char)c;
+	while (n >= 8) {
+		memcpy(&w, h + n - 8, 8);
+		w ^= pat;
+		if ((w - ones) & ~w & (ones << 7))
+			break;
+		n -= 8;
+	}
+	while (n > 0) {
+		n--;
+		if (h[n] == (char)c)
+			return h + n;
+	}
+	return NULL;
+}
+
+/* memfind finds the first pat in h[0..n) (NULL if none). */
+static const char *
+memfind(struct finder *f, const char *h, size_t n)
+{
+	const char *p, *q, *end;
+	size_t l, miss;
+	char c;
+
+	l = f->pat.len;
+	if (n < l)
+		return NULL;
+	p = f->pat.s;
+	if (l == 1)
+		return memchr(h, p[0], n);
+
+	/* candidates start in [h, end]; the rare byte sits f->rare further on. */
+	c = p[f->rare];
+	end = h + (n - l);
+	miss = 0;
+	q = h;
+	while (q <= end) {
+		const char *r;
+
+		r = memchr(q + f->rare, c, (size_t)(end - q) + 1);
+		if (!r)
+			return NULL;
+		q = r - f->rare;
+		if (!memcmp(q, p, l))
+			return q;
+		q++;
+		/* the rare byte is not rare here: stop paying for the restarts. */
+		if (++miss > findslack + (size_t)(q - h) / 64) {
+			size_t k;
+
+			k = twoway(&f->fw, p, l, q, (size_t)(end - q) + l, 1);
+			return k == (size_t)-1 ? NULL : q + k;
+		}
+	}
+	return NULL;
+}
+
+/* memrfind finds the last pat in h[0..n) (NULL if none). */
+static const char *
+memrfind(struct finder *f, const char *h, size_t n)
+{
+	const char *p, *r;
+	size_t l, m, miss;
+
+	l = f->pat.len;
+	if (n < l)
+		return NULL;
+	p = f->pat.s;
+	if (l == 1)
+		return rchr(h, p[0], n);
+
+	/* m candidates are left, starting at h[0..m). */
+	m = n - l + 1;
+	miss = 0;
+	while (m > 0) {
+		size_t k;
+
+		r = rchr(h + f->rare, p[f->rare], m);
+		if (!r)
+			return NULL;
+		m = (size_t)(r - h) - f->rare;
+		if (!memcmp(h + m, p, l))
+			return h + m;
+		if (++miss > findslack + (n - l + 1 - m) / 64) {
+			/* the bytes that candidates before m can cover. */
+			if (m == 0)
+				return NULL;
+			k = twoway(&f->bw, f->rpat.s, l, h + m + l - 2, m + l - 1, -1);
+			return k == (size_t)-1 ? NULL : h + m - 1 - k;
+		}
+	}
+	return NULL;
+}
+
+/* findspans looks for pat wholly in [lo,hi), span by span: the first match, or the last when last is set. */
+static int
+findspans(struct editor *e, struct finder *f, size_t lo, size_t hi, bool last, size_t *pos)
+{
+	const char *s, *hit;
+	size_t at, n, w, l;
+	int found;
+
+	l = f->pat.len;
+	found = 0;
+	at = lo;
+	while (hi - at >= l) {
+		s = textspan(e, at, &n);
+		if (n > hi - at)
+			n = hi - at;
+		if (n >= l) {
+			hit = last ? memrfind(f, s, n) : memfind(f, s, n);
+			if (hit) {
+				*pos = at + (size_t)(hit - s);
+				found = 1;
+				if (!last)
+					return 1;
+			}
+			at += n - l + 1;
+			continue;
+		}
+
+		/* the span cannot hold a match: look across its end instead. */
+		w = hi - at;
+		if (w > n + l - 1)
+			w = n + l - 1;
+		sbufsetlen(&f->win, w);
+		textcopy(e, at, w, f->win.s);
+		hit = last ? memrfind(f, f->win.s, w) : memfind(f, f->win.s, w);
+		if (hit) {
+			*pos = at + (size_t)(hit - f->win.s);
+			found = 1;
+			if (!last)
+				return 1;
+		}
+		at += n;
+	}
+	return found;
+}
+
+/* findlit finds the first pat lying wholly in [start,end) of the text (1 found, 0 not). */
+int
+findlit(struct editor *e, const char *pat, size_t plen, size_t start, size_t end, size_t *pos)
+{
+	if (plen == 0)
+		return 0;
+	if (end > textlen(e))
+		end = textlen(e);
+	if (start > end || plen > end - start)
+		return 0;
+	return findspans(e, finderfor(pat, plen), start, end, false, pos);
+}
+
+/* findlitrev finds the last pat lying wholly in [start,end) of the text (1 found, 0 not). */
+int
+findlitrev(struct editor *e, const char *pat, size_t plen, size_t start, size_t end, size_t *pos)
+{
+	struct finder *f;
+	size_t lo, hi, blk;
+
+	if (plen == 0)
+		return 0;
+	if (end > textlen(e))
+		end = textlen(e);
+	if (start > end || plen > end - start)
+		return 0;
+
+	f = finderfor(pat, plen);
+	blk = findblk;
+	hi = end;
+	for (;;) {
+		/* blk candidates at most, the ones starting in [lo, hi-plen]. */
+		lo = start;
+		if (hi - start - plen + 1 > blk)
+			lo = hi - plen + 1 - blk;
+		if (findspans(e, f, lo, hi, true, pos))
+			return 1;
+		if (lo == start)
+			return 0;
+		hi = lo + plen - 1;
+		if (blk < findblkmax)
+			blk *= 2;
+	}
+}
@@ -0,0 +1,12 @@
+#ifndef FIND_H
+#define FIND_H
+
+#include "wee.h"
+
+/* findlit finds the first pat lying wholly in [start,end) of the text (1 found, 0 not). */
+int findlit(struct editor *e, const char *pat, size_t plen, size_t start, size_t end, size_t *pos);
+
+/* findlitrev finds the last pat lying wholly in [start,end) of the text (1 found, 0 not). */
+int findlitrev(struct editor *e, const char *pat, size_t plen, size_t start, size_t end, size_t *pos);
+
+#endif
@@ -0,0 +1,437 @@
+#include "job.h"
+
+#include "edit.h"
+#include "lines.h"
+#include "render.h"
+#include "sbuf.h"
+#include "status.h"
+#include "term.h"
+#include "text.h"
+#include "undo.h"
+#include "wee_util.h"
+
+/*
+ * background jobs.
+ *
+ * :run starts its command here. the child's stdout is watched by the
+ * input loop (termwatch), and whatever it writes is inserted at the
+ * job's insertion point as it arrives, while the editor stays usable.
+ * edits elsewhere move the insertion point along (jobedit, called by
+ * bufins and bufdel). the output forms one undo entry unless other edits
+ * land in between.
+ *
+ * :{range}!cmd filters through jobfilter instead, which waits for the
+ * command: the range is written to its stdin straight from the text
+ * spans while its stdout is read back, both through fixed-size chunks,
+ * so neither side can fill a pipe and stall the other. ^C stops the
+ * command and leaves the range as it was.
+ *
+ * nothing here waits on a child that may not exit: a job or filter
+ * whose child is still running when its output ends is left to
+ * jobtick, which the main loop calls to reap it, and a stopped job
+ * that ignores SIGTERM gets SIGKILL after jobgrace.
+ */
+
+enum {
+	jobms = 20, /* longest one wakeup spends reading output */
+	filterbuf = 65536, /* most one write or read moves through a filter */
+	jobgrace = 500, /* ms a stopped job gets to exit before SIGKILL */
+	jobreapms = 100, /* how often children still running are checked */
+};
+
+struct job {
+	pid_t pid;
+	int fd;
+	size_t at; /* where the next output goes */
+	size_t nbytes;
+	int grp; /* undo group the output merges into */
+};
+
+/* a child whose job has ended but which has not exited yet. */
+struct reap {
+	pid_t pid;
+	long long killat; /* when it gets SIGKILL (0: never) */
+};
+
+static struct reap *reaps;
+static int nreaps, reapcap;
+
+/* jobreap reaps pid now if it has exited, or leaves it to jobtick. */
+static void
+jobreap(pid_t pid, long long killat)
+{
+	if (waitpid(pid, NULL, WNOHANG) != 0)
+		return;
+	if (nreaps == reapcap) {
+		struct reap *nr;
+
+		reapcap = reapcap ? reapcap * 2 : 8;
+		nr = realloc(reaps, (size_t)reapcap * sizeof(reaps[0]));
+		if (!nr)
+			die("out of memory");
+		reaps = nr;
+	}
+	reaps[nreaps].pid = pid;
+	reaps[nreaps].killat = killat;
+	nreaps++;
+}
+
+/* jobend ends the job, leaving its child to be reaped, and reports how it went. */
+static void
+jobend(struct editor *e, bool killed)
+{
+	struct job *j;
+
+	j = e->job;
+	termwatch(j->fd, NULL, NULL);
+	close(j->fd);
+	if (killed)
+		kill(-j->pid, SIGTERM);
+	jobreap(j->pid, killed ? nowms() + jobgrace : 0);
+	if (killed)
+		setstatus(e, "run: stopped after %zu bytes", j->nbytes);
+	else if (j->nbytes == 0)
+		setstatus(e, "run: no output");
+	else
+		setstatus(e, "run: %zu bytes", j->nbytes);
+	free(j);
+	e->job = NULL;
+}
+
+/* jobput inserts n bytes of output at the insertion point. */
+static void
+jobput(struct editor *e, const char *p, size_t n)
+{
+	struct job *j;
+	size_t at;
+	int grp;
+
+	j = e->job;
+	if (j->at > textlen(e))
+		j->at = textlen(e);
+	at = j->at;
+	grp = e->insgrp;
+	e->insgrp = j->grp;
+	undopushins(e, at, p, n, e->cur, true);
+	e->insgrp = grp;
+	/* jobedit moves j->at past the new text. */
+	bufins(e, at, p, n);
+	/* text at or after the insertion point moves along, the end of the buffer included. */
+	if (e->cur >= at)
+		e->cur += n;
+	if (e->vmark >= at)
+		e->vmark += n;
+	e->dirty = true;
+	j->nbytes += n;
+}
+
+/* jobread takes what the job has written (termwatch handler). */
+static void
+jobread(int fd, void *arg)
+{
+	struct editor *e;
+	struct sbuf out = {0};
+	char buf[65536];
+	long long t0;
+	ssize_t n;
+	bool eof;
+
+	e = arg;
+	eof = false;
+	t0 = nowms();
+	do {
+		n = read(fd, buf, sizeof(buf));
+		if (n > 0)
+			sbufins(&out, out.len, buf, (size_t)n);
+		else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+			eof = true;
+	} while (n > 0 && nowms() - t0 < jobms);
+	if (out.len) {
+		jobput(e, out.s, out.len);
+		setstatus(e, "run: %zu bytes (Ctrl-C stops it)", e->job->nbytes);
+	}
+	sbuffree(&out);
+	if (eof)
+		jobend(e, false);
+}
+
+/* jobspawn forks cmd with stdin on in (/dev/null if -1), stdout on out and stderr on /dev/null. */
+static pid_t
+jobspawn(const char *cmd, int in, int out)
+{
+	pid_t pid;
+	int fd;
+
+	pid = fork();
+	if (pid != 0) {
+		if (pid > 0)
+			setpgid(pid, pid);
+		return pid;
+	}
+
+	/* own process group, so jobstop reaches the whole pipeline. */
+	setpgid(0, 0);
+	signal(SIGPIPE, SIG_DFL);
+	if (in < 0)
+		in = open("/dev/null", O_RDONLY);
+	if (in >= 0) {
+		dup2(in, STDIN_FILENO);
+		close(in);
+	}
+	dup2(out, STDOUT_FILENO);
+	close(out);
+	fd = open("/dev/null", O_WRONLY);
+	if (fd >= 0) {
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+
+	execl("/bin/bash", "bash", "-c", cmd, (char *)NULL);
+	execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+	_exit(127);
+}
+
+/* jobstart runs cmd in the background, inserting its stdout at at as it arrives (0 ok, -1 error). */
+int
+jobstart(struct editor *e, const char *cmd, size_t at)
+{
+	struct job *j;
+	int pfd[2];
+	pid_t pid;
+
+	if (pipe(pfd) == -1)
+		return -1;
+	fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+	pid = jobspawn(cmd, -1, pfd[1]);
+	close(pfd[1]);
+	if (pid == -1) {
+		close(pfd[0]);
+		return -1;
+	}
+
+	fcntl(pfd[0], F_SETFL, fcntl(pfd[0], F_GETFL) | O_NONBLOCK);
+	j = calloc(1, sizeof(*j));
+	if (!j)
+		die("out of memory");
+	j->pid = pid;
+	j->fd = pfd[0];
+	j->at = at;
+	j->grp = ++e->insgrp;
+	e->job = j;
+	termwatch(j->fd, jobread, e);
+	return 0;
+}
+
+/* filterput inserts filter output at at, holding back a final newline when trim is set. */
+static size_t
+filterput(struct editor *e, size_t at, const char *p, size_t n, bool trim, bool *held)
+{
+	size_t put;
+
+	put = 0;
+	if (*held) {
+		undopushins(e, at, "\n", 1, e->cur, true);
+		bufins(e, at, "\n", 1);
+		put = 1;
+		*held = false;
+	}
+	if (trim && n > 0 && p[n - 1] == '\n') {
+		n--;
+		*held = true;
+	}
+	if (n > 0) {
+		undopushins(e, at + put, p, n, e->cur, true);
+		bufins(e, at + put, p, n);
+	}
+	return put + n;
+}
+
+/* jobfilter replaces [a,b) with what cmd prints when fed it, as one undo step (0 ok, -1 error). */
+int
+jobfilter(struct editor *e, const char *cmd, size_t a, size_t b)
+{
+	struct sigaction ign, old;
+	struct pollfd pfd[3];
+	char buf[filterbuf];
+	int in[2], out[2];
+	size_t wpos, put;
+	bool trim, held, dirty;
+	long long t0;
+	pid_t pid, r;
+	int st;
+
+	if (pipe(in) == -1)
+		return -1;
+	if (pipe(out) == -1) {
+		close(in[0]);
+		close(in[1]);
+		return -1;
+	}
+	fcntl(in[1], F_SETFD, FD_CLOEXEC);
+	fcntl(out[0], F_SETFD, FD_CLOEXEC);
+	pid = jobspawn(cmd, in[0], out[1]);
+	close(in[0]);
+	close(out[1]);
+	if (pid == -1) {
+		close(in[1]);
+		close(out[0]);
+		return -1;
+	}
+	fcntl(in[1], F_SETFL, fcntl(in[1], F_GETFL) | O_NONBLOCK);
+
+	/* a command that stops reading early must not take the editor down. */
+	memset(&ign, 0, sizeof(ign));
+	ign.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ign, &old);
+
+	/* the output's last newline would add a line the range never had. */
+	trim = b == textlen(e) && (b == a || textbyte(e, b - 1) != '\n');
+	held = false;
+	dirty = e->dirty;
+	/* output goes in after the range, so the spans still to be written stay put. */
+	wpos = a;
+	put = b;
+	e->insgrp++;
+	pfd[0].fd = in[1];
+	pfd[0].events = POLLOUT;
+	pfd[1].fd = out[0];
+	pfd[1].events = POLLIN;
+	pfd[2].fd = STDIN_FILENO;
+	pfd[2].events = POLLIN;
+	if (wpos == b) {
+		close(in[1]);
+		pfd[0].fd = -1;
+	}
+	setstatus(e, "filter: running (Ctrl-C stops it)");
+	refresh(e);
+	while (pfd[1].fd >= 0) {
+		if (poll(pfd, 3, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfd[2].revents && termintr())
+			break;
+		if (pfd[0].fd >= 0 && pfd[0].revents) {
+			const char *s;
+			size_t n;
+			ssize_t w;
+
+			s = textspan(e, wpos, &n);
+			if (n > b - wpos)
+				n = b - wpos;
+			if (n > filterbuf)
+				n = filterbuf;
+			w = write(in[1], s, n);
+			if (w > 0)
+				wpos += (size_t)w;
+			if (wpos == b || (w == -1 && errno != EAGAIN && errno != EINTR)) {
+				close(in[1]);
+				pfd[0].fd = -1;
+			}
+		}
+		if (pfd[1].revents) {
+			ssize_t n;
+
+			n = read(out[0], buf, sizeof(buf));
+			if (n > 0) {
+				put += filterput(e, put, buf, (size_t)n, trim, &held);
+			} else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+				close(out[0]);
+				pfd[1].fd = -1;
+			}
+		}
+	}
+	if (pfd[0].fd >= 0)
+		close(in[1]);
+	sigaction(SIGPIPE, &old, NULL);
+	if (pfd[1].fd >= 0) {
+		/* stopped: take its output back out and leave the range alone. */
+		close(out[0]);
+		kill(-pid, SIGTERM);
+		jobreap(pid, nowms() + jobgrace);
+		if (put > b)
+			undodo(e);
+		e->cur = a;
+		e->dirty = dirty;
+		clampcur(e);
+		setstatus(e, "filter: stopped, text unchanged");
+		return 0;
+	}
+	/* its output is complete; give it jobgrace to report how it went. */
+	t0 = nowms();
+	while ((r = waitpid(pid, &st, WNOHANG)) == 0 && nowms() - t0 < jobgrace)
+		poll(NULL, 0, 5);
+	if (r == 0) {
+		jobreap(pid, 0);
+		st = 0;
+	} else if (r == -1) {
+		st = 0;
+	} else {
+		st = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+	}
+
+	if (put == b && st != 0) {
+		setstatus(e, "filter: exit %d, text unchanged", st);
+		return 0;
+	}
+	bufdelrange(e, a, b);
+	if (put > b)
+		undojoin(e);
+	e->cur = a;
+	e->dirty = true;
+	clampcur(e);
+	if (st != 0)
+		setstatus(e, "filter: exit %d, %zu bytes in, %zu out", st, b - a, put - b);
+	else
+		setstatus(e, "filter: %zu bytes in, %zu out", b - a, put - b);
+	return 0;
+}
+
+/* jobtick reaps the children of ended jobs; returns ms until it wants to run again (-1: never). */
+int
+jobtick(void)
+{
+	int i;
+
+	i = 0;
+	while (i < nreaps) {
+		if (waitpid(reaps[i].pid, NULL, WNOHANG) != 0) {
+			reaps[i] = reaps[--nreaps];
+			continue;
+		}
+		if (reaps[i].killat && nowms() >= reaps[i].killat) {
+			kill(-reaps[i].pid, SIGKILL);
+			reaps[i].killat = 0;
+		}
+		i++;
+	}
+	return nreaps ? jobreapms : -1;
+}
+
+/* jobstop kills the running job and keeps what it wrote so far. */
+void
+jobstop(struct editor *e)
+{
+	if (e->job)
+		jobend(e, true);
+}
+
+/* jobedit keeps the job's insertion point on the same text across an edit of n bytes at at. */
+void
+jobedit(struct editor *e, size_t at, size_t n, bool ins)
+{
+	struct job *j;
+
+	j = e->job;
+	if (!j)
+		return;
+	if (ins) {
+		if (at <= j->at)
+			j->at += n;
+	} else if (at + n <= j->at) {
+		j->at -= n;
+	} else if (at < j->at) {
+		j->at = at;
+	}
+}
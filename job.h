@@ -0,0 +1,21 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include "wee.h"
+
+/* jobstart runs cmd in the background, inserting its stdout at at as it arrives (0 ok, -1 error). */
+int jobstart(struct editor *e, const char *cmd, size_t at);
+
+/* jobfilter replaces [a,b) with what cmd prints when fed it, as one undo step (0 ok, -1 error). */
+int jobfilter(struct editor *e, const char *cmd, size_t a, size_t b);
+
+/* jobtick reaps the children of ended jobs; returns ms until it wants to run again (-1: never). */
+int jobtick(void);
+
+/* jobstop kills the running job and keeps what it wrote so far. */
+void jobstop(struct editor *e);
+
+/* jobedit keeps the job's insertion point on the same text across an edit of n bytes at at. */
+void jobedit(struct editor *e, size_t at, size_t n, bool ins);
+
+#endif
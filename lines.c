@@ -1,15 +1,116 @@
 #include "lines.h"
 
-#include "utf.h"
+#include "nl.h"
+#include "text.h"
 #include "wee_util.h"
 
 /*
  * line indexing and cursor mapping.
  *
- * this module maintains a cached table of line-start offsets and provides
- * helpers to map byte offsets to (row,col) and back.
+ * this module maintains a cached table of line lengths and provides
+ * helpers to map byte offsets to (row,col) and back. backends that count
+ * newlines themselves (textnl) are asked directly instead.
+ *
+ * the lengths are kept in blocks of at most linesblk lines, with a fenwick
+ * tree over the blocks' byte and line totals. a row or offset is found by
+ * walking the tree to its block and then the block itself, and an edit
+ * touches one block and O(log blocks) tree nodes; only a block split or
+ * merge rebuilds the tree. the last line has no newline and may be empty,
+ * so every other block has a nonzero byte total.
  */
 
+enum {
+	linesblock = 1 << 16, /* bytes scanned per step by the line helpers */
+	linesbg = 1 << 24,    /* buffers above this are indexed in the background */
+	linesslice = 1 << 24, /* most bytes the indexer publishes (and lists) at once */
+	linesthr = 64,        /* most indexing threads */
+	linesblk = 256,       /* most lines per block */
+	linesfill = 192,      /* lines per block when filling or splitting */
+	linesinfos = 256,     /* lines in the per-line info cache */
+	lineslong = 1 << 16,  /* lines longer than this get column checkpoints */
+	linesckpt = 1 << 12,  /* bytes between checkpoints */
+};
+
+/*
+ * a run of lines. lengths are stored in the fewest bytes (1, 2, 4 or
+ * sizeof(size_t)) that fit the block's longest line, and the block is
+ * widened in place when a longer one arrives.
+ */
+struct lineblk {
+	int n;        /* lines in the block */
+	int w;        /* bytes per length */
+	size_t bytes; /* their total length */
+	unsigned char len[];
+};
+
+/* the line table: blocks in order, and fenwick trees over them (1-based). */
+struct linetab {
+	struct lineblk **b;
+	int nb;
+	int cap;
+	size_t *fb;   /* bytes */
+	size_t *fn;   /* lines */
+	int top;      /* highest power of two <= nb */
+};
+
+/* a place in a long line where a column step starts, and its column. */
+struct linecheck {
+	size_t off;
+	int col;
+	bool tab; /* a tab lies between here and the next checkpoint (or le) */
+};
+
+/* what off2col and offatcol need to know about one line. */
+struct lineinfo {
+	unsigned long gen; /* editgen when filled */
+	size_t ls;
+	size_t le;
+	int width;         /* display columns up to le */
+	bool ascii;        /* no byte >= 0x80 */
+	bool tabs;         /* holds a tab */
+	struct linecheck *ck; /* every linesckpt bytes, for long lines that need walking */
+	size_t nck;
+	size_t ckcap;
+};
+
+/* a run of buffer bytes starting at offset at. */
+struct linerun {
+	const char *s;
+	size_t n;
+	size_t at;
+};
+
+/* the runs one indexing thread scans. */
+struct linejob {
+	struct linerun *r;
+	int nr;
+	size_t nl;   /* newlines counted in the runs */
+	size_t *out; /* where their line starts go */
+};
+
+/*
+ * background indexer. the worker appends to the line table and publishes
+ * linelen and done under mu; while it runs, the main thread reads the table
+ * only under mu and never edits the buffer. an edit stops the worker at
+ * the end of its current slice and patches the indexed prefix (or leaves
+ * it alone when the edit lies past it); the next lookup starts a new
+ * worker from where the old one stopped.
+ */
+struct lineidx {
+	pthread_t tid;
+	pthread_mutex_t mu;
+	pthread_cond_t cv;
+	struct linerun *r; /* the buffer's spans, taken before the worker starts */
+	int nr;
+	size_t len;
+	size_t done;       /* bytes [0,done) are indexed */
+	size_t last;       /* start of the table's last line */
+	bool stop;
+	bool fin;
+	size_t *st;        /* line starts of the current slice (worker only) */
+	size_t stcap;
+};
+
 /* isutfcont reports whether c is a utf-8 continuation byte. */
 static bool
 isutfcont(unsigned char c)
@@ -17,135 +118,1514 @@ isutfcont(unsigned char c)
 	return (c & 0xc0) == 0x80;
 }
 
+/*
+ * linesjoin waits for the background indexer to finish (or stops it after
+ * its current slice) and frees it. a stopped indexer leaves linepart set.
+ */
+static void
+linesjoin(struct editor *e, bool stop)
+{
+	struct lineidx *x;
+
+	x = e->lineidx;
+	if (!x)
+		return;
+	pthread_mutex_lock(&x->mu);
+	if (stop)
+		x->stop = true;
+	while (!x->fin)
+		pthread_cond_wait(&x->cv, &x->mu);
+	pthread_mutex_unlock(&x->mu);
+	pthread_join(x->tid, NULL);
+	e->linepart = x->done < x->len;
+	e->linefront = x->done;
+	pthread_mutex_destroy(&x->mu);
+	pthread_cond_destroy(&x->cv);
+	free(x->r);
+	free(x->st);
+	free(x);
+	e->lineidx = NULL;
+}
+
 /* linesdirty marks the line-start cache as needing a rebuild. */
 void
 linesdirty(struct editor *e)
 {
+	linesjoin(e, true);
+	e->linepart = false;
 	e->linedirty = true;
+	e->editgen++;
 }
 
-/* linesgrow ensures the line-start table capacity is at least need entries. */
+/* tabgrow ensures room for need blocks. */
 static void
-linesgrow(struct editor *e, int need)
+tabgrow(struct linetab *t, int need)
 {
+	struct lineblk **nb;
+	size_t *fb, *fn;
 	int nc;
-	size_t *ns;
 
-	if (e->linecap >= need)
+	if (t->cap >= need)
 		return;
-	nc = e->linecap ? e->linecap : 128;
+	nc = t->cap ? t->cap : 16;
 	while (nc < need)
 		nc *= 2;
+	nb = realloc(t->b, (size_t)nc * sizeof(t->b[0]));
+	if (nb)
+		t->b = nb;
+	fb = realloc(t->fb, (size_t)(nc + 1) * sizeof(t->fb[0]));
+	if (fb)
+		t->fb = fb;
+	fn = realloc(t->fn, (size_t)(nc + 1) * sizeof(t->fn[0]));
+	if (fn)
+		t->fn = fn;
+	if (!nb || !fb || !fn)
+		die("out of memory");
+	t->cap = nc;
+}
 
-	ns = realloc(e->linest, (size_t)nc * sizeof(e->linest[0]));
-	if (!ns)
+/* blkwidth returns the bytes needed to store the length n. */
+static int
+blkwidth(size_t n)
+{
+	if (n <= 0xff)
+		return 1;
+	if (n <= 0xffff)
+		return 2;
+	if (n <= 0xffffffff)
+		return 4;
+	return (int)sizeof(size_t);
+}
+
+/* blkraw returns entry i of an array of w-byte lengths. */
+static size_t
+blkraw(const void *p, int w, int i)
+{
+	switch (w) {
+	case 1:
+		return ((const uint8_t *)p)[i];
+	case 2:
+		return ((const uint16_t *)p)[i];
+	case 4:
+		return ((const uint32_t *)p)[i];
+	default:
+		return ((const size_t *)p)[i];
+	}
+}
+
+/* blkput stores n as entry i of an array of w-byte lengths. */
+static void
+blkput(void *p, int w, int i, size_t n)
+{
+	switch (w) {
+	case 1:
+		((uint8_t *)p)[i] = (uint8_t)n;
+		break;
+	case 2:
+		((uint16_t *)p)[i] = (uint16_t)n;
+		break;
+	case 4:
+		((uint32_t *)p)[i] = (uint32_t)n;
+		break;
+	default:
+		((size_t *)p)[i] = n;
+		break;
+	}
+}
+
+/* blkget returns the length of line i of b. */
+static size_t
+blkget(const struct lineblk *b, int i)
+{
+	return blkraw(b->len, b->w, i);
+}
+
+/* blknew returns a new empty block of w-byte lengths. */
+static struct lineblk *
+blknew(int w)
+{
+	struct lineblk *b;
+
+	b = malloc(sizeof(*b) + linesblk * (size_t)w);
+	if (!b)
 		die("out of memory");
-	e->linest = ns;
-	e->linecap = nc;
+	b->n = 0;
+	b->w = w;
+	b->bytes = 0;
+	return b;
 }
 
-/* linesbuild rebuilds the line-start table for the whole buffer. */
+/* blkwiden makes *bp hold lengths of at least w bytes. */
 static void
-linesbuild(struct editor *e)
+blkwiden(struct lineblk **bp, int w)
+{
+	struct lineblk *b;
+	int i;
+
+	b = *bp;
+	if (b->w >= w)
+		return;
+	b = realloc(b, sizeof(*b) + linesblk * (size_t)w);
+	if (!b)
+		die("out of memory");
+	/* back to front, so no entry is overwritten before it is read. */
+	for (i = b->n - 1; i >= 0; i--)
+		blkput(b->len, w, i, blkraw(b->len, b->w, i));
+	b->w = w;
+	*bp = b;
+}
+
+/* blkset stores n as line i of *bp, widening the block if n does not fit. */
+static void
+blkset(struct lineblk **bp, int i, size_t n)
+{
+	blkwiden(bp, blkwidth(n));
+	blkput((*bp)->len, (*bp)->w, i, n);
+}
+
+/* blkmove moves lines [from,n) of b to start at to (to + n - from <= linesblk). */
+static void
+blkmove(struct lineblk *b, int to, int from)
+{
+	memmove(b->len + (size_t)to * (size_t)b->w, b->len + (size_t)from * (size_t)b->w,
+	    (size_t)(b->n - from) * (size_t)b->w);
+}
+
+/* tabbuild rebuilds the fenwick trees from the block totals in O(blocks). */
+static void
+tabbuild(struct linetab *t)
+{
+	int i, j;
+
+	for (i = 1; i <= t->nb; i++) {
+		t->fb[i] = t->b[i - 1]->bytes;
+		t->fn[i] = (size_t)t->b[i - 1]->n;
+	}
+	for (i = 1; i <= t->nb; i++) {
+		j = i + (i & -i);
+		if (j <= t->nb) {
+			t->fb[j] += t->fb[i];
+			t->fn[j] += t->fn[i];
+		}
+	}
+	for (t->top = 1; t->top * 2 <= t->nb; t->top *= 2)
+		;
+}
+
+/* tabadd adds db bytes and dn lines to block i (both wrap, so they may be "negative"). */
+static void
+tabadd(struct linetab *t, int i, size_t db, size_t dn)
+{
+	for (i++; i <= t->nb; i += i & -i) {
+		t->fb[i] += db;
+		t->fn[i] += dn;
+	}
+}
+
+/* tabreset empties the table down to one empty line. */
+static void
+tabreset(struct linetab *t)
+{
+	int i;
+
+	for (i = 0; i < t->nb; i++)
+		free(t->b[i]);
+	tabgrow(t, 1);
+	t->b[0] = blknew(1);
+	t->nb = 1;
+	t->b[0]->n = 1;
+	blkput(t->b[0]->len, 1, 0, 0);
+	tabbuild(t);
+}
+
+/* tabpush appends a line of length n (the trees are rebuilt by the caller). */
+static void
+tabpush(struct linetab *t, size_t n)
+{
+	if (t->b[t->nb - 1]->n >= linesfill) {
+		tabgrow(t, t->nb + 1);
+		t->b[t->nb++] = blknew(1);
+	}
+	t->b[t->nb - 1]->n++;
+	blkset(&t->b[t->nb - 1], t->b[t->nb - 1]->n - 1, n);
+	t->b[t->nb - 1]->bytes += n;
+}
+
+/* tablast sets the length of the last line (the trees are rebuilt by the caller). */
+static void
+tablast(struct linetab *t, size_t n)
+{
+	struct lineblk **bp;
+
+	bp = &t->b[t->nb - 1];
+	(*bp)->bytes += n - blkget(*bp, (*bp)->n - 1);
+	blkset(bp, (*bp)->n - 1, n);
+}
+
+/*
+ * tabappend extends the table from end-of-table to end, given the n line
+ * starts st in between. *last is the start of the table's last line.
+ */
+static void
+tabappend(struct linetab *t, size_t *last, const size_t *st, size_t n, size_t end)
 {
 	size_t i;
-	int n;
 
-	linesgrow(e, 1);
-	e->linest[0] = 0;
-	n = 1;
-	for (i = 0; i < e->buf.len; i++) {
-		if (e->buf.s[i] == '\n') {
-			linesgrow(e, n + 1);
-			e->linest[n++] = i + 1;
+	if (n == 0) {
+		tablast(t, end - *last);
+		return;
+	}
+	tablast(t, st[0] - *last);
+	for (i = 1; i < n; i++)
+		tabpush(t, st[i] - st[i - 1]);
+	tabpush(t, end - st[n - 1]);
+	*last = st[n - 1];
+}
+
+/*
+ * tabrow returns the row holding byte off (the last row past the end),
+ * with its block in *bi, its index there in *j and its start in *at.
+ */
+static size_t
+tabrow(struct linetab *t, size_t off, int *bi, int *j, size_t *at)
+{
+	struct lineblk *b;
+	size_t row, rem, k;
+	int pos, step, i;
+
+	pos = 0;
+	row = 0;
+	rem = off;
+	for (step = t->top; step > 0; step >>= 1) {
+		if (pos + step <= t->nb && t->fb[pos + step] <= rem) {
+			pos += step;
+			rem -= t->fb[pos];
+			row += t->fn[pos];
 		}
 	}
-	e->linelen = n;
+	if (pos == t->nb) {
+		/* at or past the end: the last line. */
+		pos--;
+		b = t->b[pos];
+		row -= (size_t)b->n;
+		rem += b->bytes;
+	}
+	b = t->b[pos];
+	for (i = 0; i < b->n - 1 && rem >= (k = blkget(b, i)); i++)
+		rem -= k;
+	*bi = pos;
+	*j = i;
+	*at = off - rem;
+	return row + (size_t)i;
+}
+
+/* taboff returns the start of row (the buffer end past the last row), with its block in *bi and index in *j. */
+static size_t
+taboff(struct linetab *t, size_t row, int *bi, int *j)
+{
+	struct lineblk *b;
+	size_t at, rem;
+	int pos, step, i;
+
+	pos = 0;
+	at = 0;
+	rem = row;
+	for (step = t->top; step > 0; step >>= 1) {
+		if (pos + step <= t->nb && t->fn[pos + step] <= rem) {
+			pos += step;
+			rem -= t->fn[pos];
+			at += t->fb[pos];
+		}
+	}
+	if (pos == t->nb) {
+		b = t->b[pos - 1];
+		*bi = pos - 1;
+		*j = b->n;
+		return at;
+	}
+	b = t->b[pos];
+	for (i = 0; (size_t)i < rem; i++)
+		at += blkget(b, i);
+	*bi = pos;
+	*j = i;
+	return at;
+}
+
+/* tabdrop removes block i (kept if it is the last one). */
+static void
+tabdrop(struct linetab *t, int i)
+{
+	if (t->nb == 1)
+		return;
+	free(t->b[i]);
+	memmove(t->b + i, t->b + i + 1, (size_t)(t->nb - i - 1) * sizeof(t->b[0]));
+	t->nb--;
+}
+
+/*
+ * tabsplice replaces the nold lines at row with the nnew lengths in len.
+ * edits within one block only update the trees; splits and merges rebuild them.
+ */
+static void
+tabsplice(struct linetab *t, size_t row, size_t nold, const size_t *len, size_t nnew)
+{
+	struct lineblk *b, *nx;
+	size_t save[linesblk];
+	size_t left, s, k, total, i, m;
+	int bi, ci, j, cj, nn, w;
+	bool rebuild;
+
+	(void)taboff(t, row, &bi, &j);
+	rebuild = false;
+
+	/* delete, block by block; blocks emptied past the first are dropped. */
+	ci = bi;
+	cj = j;
+	for (left = nold; left > 0; ) {
+		b = t->b[ci];
+		k = (size_t)(b->n - cj);
+		if (k > left)
+			k = left;
+		s = 0;
+		for (i = 0; i < k; i++)
+			s += blkget(b, cj + (int)i);
+		blkmove(b, cj, cj + (int)k);
+		b->n -= (int)k;
+		b->bytes -= s;
+		tabadd(t, ci, -s, -k);
+		left -= k;
+		if (ci != bi && b->n == 0) {
+			tabdrop(t, ci);
+			rebuild = true;
+		} else {
+			ci++;
+		}
+		cj = 0;
+	}
+
+	/* insert at (bi,j), splitting the block evenly if it overflows. */
+	b = t->b[bi];
+	if ((size_t)b->n + nnew <= linesblk) {
+		s = 0;
+		w = 1;
+		for (i = 0; i < nnew; i++) {
+			s += len[i];
+			if (blkwidth(len[i]) > w)
+				w = blkwidth(len[i]);
+		}
+		blkwiden(&t->b[bi], w);
+		b = t->b[bi];
+		blkmove(b, j + (int)nnew, j);
+		b->n += (int)nnew;
+		for (i = 0; i < nnew; i++)
+			blkput(b->len, b->w, j + (int)i, len[i]);
+		b->bytes += s;
+		tabadd(t, bi, s, nnew);
+	} else {
+		for (ci = 0; ci < b->n; ci++)
+			save[ci] = blkget(b, ci);
+		total = (size_t)b->n + nnew;
+		nn = (int)((total + linesfill - 1) / linesfill);
+		tabgrow(t, t->nb + nn - 1);
+		memmove(t->b + bi + nn, t->b + bi + 1, (size_t)(t->nb - bi - 1) * sizeof(t->b[0]));
+		for (ci = 1; ci < nn; ci++)
+			t->b[bi + ci] = blknew(1);
+		t->nb += nn - 1;
+		b->n = 0;
+		b->bytes = 0;
+		for (i = 0; i < total; i++) {
+			if (i < (size_t)j)
+				s = save[i];
+			else if (i < (size_t)j + nnew)
+				s = len[i - (size_t)j];
+			else
+				s = save[i - nnew];
+			m = i * (size_t)nn / total;
+			ci = bi + (int)m;
+			t->b[ci]->n++;
+			blkset(&t->b[ci], t->b[ci]->n - 1, s);
+			t->b[ci]->bytes += s;
+		}
+		rebuild = true;
+	}
+
+	/* keep blocks from thinning out: merge a small block into its neighbour. */
+	b = t->b[bi];
+	if (b->n == 0) {
+		tabdrop(t, bi);
+		rebuild = true;
+	} else if (bi + 1 < t->nb && b->n + t->b[bi + 1]->n <= linesblk / 2) {
+		nx = t->b[bi + 1];
+		blkwiden(&t->b[bi], nx->w);
+		b = t->b[bi];
+		for (ci = 0; ci < nx->n; ci++)
+			blkput(b->len, b->w, b->n + ci, blkget(nx, ci));
+		b->n += nx->n;
+		b->bytes += nx->bytes;
+		tabdrop(t, bi + 1);
+		rebuild = true;
+	}
+	if (rebuild)
+		tabbuild(t);
+}
+
+/* linestab returns the editor's line table, creating it on first use. */
+static struct linetab *
+linestab(struct editor *e)
+{
+	if (!e->linetab) {
+		e->linetab = calloc(1, sizeof(*e->linetab));
+		if (!e->linetab)
+			die("out of memory");
+		tabreset(e->linetab);
+	}
+	return e->linetab;
+}
+
+/* linescount counts the newlines in a job's runs. */
+static void *
+linescount(void *arg)
+{
+	struct linejob *j;
+	int i;
+
+	j = arg;
+	j->nl = 0;
+	for (i = 0; i < j->nr; i++)
+		j->nl += countnl(j->r[i].s, j->r[i].n);
+	return NULL;
+}
+
+/* lineslist stores the line starts of a job's runs at j->out. */
+static void *
+lineslist(void *arg)
+{
+	struct linejob *j;
+	size_t *out;
+	int i;
+
+	j = arg;
+	out = j->out;
+	for (i = 0; i < j->nr; i++)
+		out += listnl(j->r[i].s, j->r[i].n, j->r[i].at, out);
+	return NULL;
+}
+
+/* lineseach runs fn on every job, one thread each. */
+static void
+lineseach(struct linejob *job, int n, void *(*fn)(void *))
+{
+	pthread_t tid[linesthr];
+	bool started[linesthr];
+	int i;
+
+	for (i = 1; i < n; i++) {
+		started[i] = pthread_create(&tid[i], NULL, fn, &job[i]) == 0;
+		if (!started[i])
+			fn(&job[i]);
+	}
+	fn(&job[0]);
+	for (i = 1; i < n; i++)
+		if (started[i])
+			pthread_join(tid[i], NULL);
+}
+
+/*
+ * linesrange lists the line starts in bytes [at,end) into x->st with nthr
+ * threads: each counts the newlines in its share, a prefix sum gives each
+ * share its first slot, then all of them list their starts into place.
+ * *ri is the first run not yet fully indexed. returns the starts listed.
+ */
+static size_t
+linesrange(struct lineidx *x, int *ri, size_t at, size_t end, int nthr)
+{
+	struct linejob job[linesthr];
+	struct linerun *r;
+	size_t per, fill, nl;
+	size_t *out;
+	int nr, cap, i, j;
+
+	per = (end - at) / (size_t)nthr + 1;
+	memset(job, 0, sizeof(job));
+	r = NULL;
+	nr = 0;
+	cap = 0;
+	j = 0;
+	fill = 0;
+	while (at < end) {
+		struct linerun *q;
+		size_t o, k;
+
+		q = &x->r[*ri];
+		o = at - q->at;
+		k = q->n - o;
+		if (k > end - at)
+			k = end - at;
+		if (k > per - fill)
+			k = per - fill;
+		if (nr == cap) {
+			struct linerun *nrun;
+
+			cap = cap ? cap * 2 : 64;
+			nrun = realloc(r, (size_t)cap * sizeof(r[0]));
+			if (!nrun)
+				die("out of memory");
+			r = nrun;
+		}
+		r[nr].s = q->s + o;
+		r[nr].n = k;
+		r[nr].at = at;
+		nr++;
+		job[j].nr++;
+		if (o + k == q->n)
+			(*ri)++;
+		at += k;
+		fill += k;
+		if (fill == per) {
+			j++;
+			fill = 0;
+		}
+	}
+	job[0].r = r;
+	for (i = 1; i < nthr; i++)
+		job[i].r = job[i - 1].r + job[i - 1].nr;
+
+	lineseach(job, nthr, linescount);
+	nl = 0;
+	for (i = 0; i < nthr; i++)
+		nl += job[i].nl;
+	if (nl > x->stcap) {
+		free(x->st);
+		x->stcap = nl;
+		x->st = malloc(nl * sizeof(x->st[0]));
+		if (!x->st)
+			die("out of memory");
+	}
+	out = x->st;
+	for (i = 0; i < nthr; i++) {
+		job[i].out = out;
+		out += job[i].nl;
+	}
+	lineseach(job, nthr, lineslist);
+	free(r);
+	return nl;
+}
+
+/* linesworker indexes the buffer in growing slices, publishing each one. */
+static void *
+linesworker(void *arg)
+{
+	struct editor *e;
+	struct lineidx *x;
+	size_t at, end, step, last, k;
+	long c;
+	int ri, nthr, n;
+
+	e = arg;
+	x = e->lineidx;
+	c = sysconf(_SC_NPROCESSORS_ONLN);
+	nthr = c < 1 ? 1 : c < linesthr ? (int)c : linesthr;
+	ri = 0;
+	last = x->last;
+	step = linesblock;
+	for (at = x->done; at < x->len; at = end) {
+		size_t nl;
+		bool stop;
+
+		pthread_mutex_lock(&x->mu);
+		stop = x->stop;
+		pthread_mutex_unlock(&x->mu);
+		if (stop)
+			break;
+
+		/* small first slices so the top of the file is ready at once. */
+		end = x->len - at < step ? x->len : at + step;
+		/* a thread per linesblock at most: starting one costs more than that scan. */
+		k = (end - at) / linesblock;
+		n = k < 1 ? 1 : k < (size_t)nthr ? (int)k : nthr;
+		nl = linesrange(x, &ri, at, end, n);
+		pthread_mutex_lock(&x->mu);
+		tabappend(e->linetab, &last, x->st, nl, end);
+		tabbuild(e->linetab);
+		e->linelen += nl;
+		x->done = end;
+		pthread_cond_broadcast(&x->cv);
+		pthread_mutex_unlock(&x->mu);
+		if (step < linesslice)
+			step *= 2;
+	}
+	pthread_mutex_lock(&x->mu);
+	x->fin = true;
+	pthread_cond_broadcast(&x->cv);
+	pthread_mutex_unlock(&x->mu);
+	return NULL;
+}
+
+/* linesspawn indexes the buffer from byte from on in the background (false if it cannot). */
+static bool
+linesspawn(struct editor *e, size_t from)
+{
+	struct lineidx *x;
+	size_t at;
+	int cap, bi, j;
+
+	x = calloc(1, sizeof(*x));
+	if (!x)
+		die("out of memory");
+	x->len = textlen(e);
+	x->done = from;
+	cap = 0;
+	for (at = from; at < x->len; at += x->r[x->nr++].n) {
+		if (x->nr == cap) {
+			struct linerun *nr;
+
+			cap = cap ? cap * 2 : 16;
+			nr = realloc(x->r, (size_t)cap * sizeof(x->r[0]));
+			if (!nr)
+				die("out of memory");
+			x->r = nr;
+		}
+		x->r[x->nr].s = textspan(e, at, &x->r[x->nr].n);
+		x->r[x->nr].at = at;
+	}
+
+	if (from == 0) {
+		tabreset(linestab(e));
+		e->linelen = 1;
+	} else {
+		x->last = taboff(e->linetab, e->linelen - 1, &bi, &j);
+	}
+	e->linedirty = false;
+	e->linepart = false;
+	pthread_mutex_init(&x->mu, NULL);
+	pthread_cond_init(&x->cv, NULL);
+	e->lineidx = x;
+	if (pthread_create(&x->tid, NULL, linesworker, e) != 0) {
+		pthread_mutex_destroy(&x->mu);
+		pthread_cond_destroy(&x->cv);
+		free(x->r);
+		free(x);
+		e->lineidx = NULL;
+		return false;
+	}
+	return true;
+}
+
+/* linesbuild rebuilds the line table for the whole buffer. */
+static void
+linesbuild(struct editor *e)
+{
+	struct linetab *t;
+	size_t at, len, last, n;
+	size_t *st;
+	size_t rows;
+
+	len = textlen(e);
+	if (len > linesbg && linesspawn(e, 0))
+		return;
+	t = linestab(e);
+	tabreset(t);
+	st = malloc(linesblock * sizeof(st[0]));
+	if (!st)
+		die("out of memory");
+	rows = 1;
+	last = 0;
+	for (at = 0; at < len; ) {
+		const char *s;
+		size_t k;
+
+		/* list the starts one cache-sized block at a time. */
+		s = textspan(e, at, &k);
+		if (k > linesblock)
+			k = linesblock;
+		n = listnl(s, k, at, st);
+		tabappend(t, &last, st, n, at + k);
+		rows += n;
+		at += k;
+	}
+	free(st);
+	tabbuild(t);
+	e->linelen = rows;
 	e->linedirty = false;
 }
 
-/* linesensure lazily rebuilds the line-start table if needed. */
+/* linesensure lazily rebuilds the line table if needed, or resumes a stopped build. */
 static void
 linesensure(struct editor *e)
 {
-	if (e->linelen == 0 || e->linedirty)
+	if (e->lineidx)
+		return;
+	if (e->linepart && !e->linedirty && linesspawn(e, e->linefront))
+		return;
+	if (e->linelen == 0 || e->linedirty || e->linepart) {
+		e->linepart = false;
 		linesbuild(e);
+	}
+}
+
+/*
+ * lineslock waits until the table holds row row and every start up to
+ * byte off. while the indexer is still running it returns with its lock
+ * held; linesunlock releases it.
+ */
+static void
+lineslock(struct editor *e, size_t row, size_t off)
+{
+	struct lineidx *x;
+	bool fin;
+
+	linesensure(e);
+	x = e->lineidx;
+	if (!x)
+		return;
+	pthread_mutex_lock(&x->mu);
+	while (!x->fin && (x->done < off || e->linelen <= row))
+		pthread_cond_wait(&x->cv, &x->mu);
+	fin = x->fin;
+	if (fin) {
+		pthread_mutex_unlock(&x->mu);
+		linesjoin(e, false);
+	}
+}
+
+/* linesunlock releases the lock taken by lineslock. */
+static void
+linesunlock(struct editor *e)
+{
+	if (e->lineidx)
+		pthread_mutex_unlock(&e->lineidx->mu);
+}
+
+/* linesbusy reports whether the line index is still being built in the background. */
+bool
+linesbusy(struct editor *e)
+{
+#ifdef TEXT_nl
+	if (textnl(e))
+		return textnlprogress(e) >= 0;
+#endif
+	return e->lineidx != NULL || e->linepart;
+}
+
+/* linesprogress returns how much of the buffer is indexed (0-99), or -1 when done. */
+int
+linesprogress(struct editor *e)
+{
+	struct lineidx *x;
+	int pct;
+
+#ifdef TEXT_nl
+	if (textnl(e))
+		return textnlprogress(e);
+#endif
+	if (e->linepart)
+		linesensure(e);
+	x = e->lineidx;
+	if (!x)
+		return -1;
+	pthread_mutex_lock(&x->mu);
+	pct = x->fin ? -1 : (int)(x->done / (x->len / 100 + 1));
+	pthread_mutex_unlock(&x->mu);
+	if (pct < 0)
+		linesjoin(e, false);
+	return pct;
+}
+
+/* infoslot returns the line info cache slot for the line starting at ls. */
+static size_t
+infoslot(size_t ls)
+{
+	return (ls ^ ls >> 7 ^ ls >> 17) % linesinfos;
+}
+
+/* a column walk over text an edit is about to make (infoline). */
+struct infowalk {
+	size_t off;  /* offset of the next byte, after the edit */
+	int col;
+	bool step;   /* the next continuation byte starts a column */
+	bool tab;    /* a tab came before the first new checkpoint */
+	size_t next; /* where the next checkpoint goes */
+	struct linecheck *ck; /* new checkpoints */
+	size_t nck;
+	size_t ckcap;
+};
+
+/* walkbytes steps w over n bytes s, marking checkpoints as linesinfo does. */
+static void
+walkbytes(struct infowalk *w, const unsigned char *s, size_t n)
+{
+	size_t j;
+
+	for (j = 0; j < n; j++, w->off++) {
+		if (s[j] != '\t' && !w->step && isutfcont(s[j]))
+			continue;
+		if (w->off >= w->next) {
+			if (w->nck == w->ckcap) {
+				struct linecheck *nck;
+
+				w->ckcap = w->ckcap ? w->ckcap * 2 : 16;
+				nck = realloc(w->ck, w->ckcap * sizeof(w->ck[0]));
+				if (!nck)
+					die("out of memory");
+				w->ck = nck;
+			}
+			w->ck[w->nck].off = w->off;
+			w->ck[w->nck].col = w->col;
+			w->ck[w->nck].tab = false;
+			w->nck++;
+			w->next = w->off + linesckpt;
+		}
+		if (s[j] == '\t') {
+			if (w->nck)
+				w->ck[w->nck - 1].tab = true;
+			else
+				w->tab = true;
+			w->col += tabstop - (w->col % tabstop);
+			w->step = true;
+		} else {
+			w->col++;
+			w->step = false;
+		}
+	}
+}
+
+/* walktext steps w over the buffer bytes [a,b). */
+static void
+walktext(struct editor *e, struct infowalk *w, size_t a, size_t b)
+{
+	const char *s;
+	size_t k;
+
+	while (a < b) {
+		s = textspan(e, a, &k);
+		if (k > b - a)
+			k = b - a;
+		walkbytes(w, (const unsigned char *)s, k);
+		a += k;
+	}
+}
+
+/*
+ * infoline carries the info of the line holding an edit over it (see
+ * curedit), so a keystroke in a long line does not rescan it. the
+ * checkpoints before the edit stay, the ones after it move by n, and
+ * only the stretch between the two around the edit is walked, marking
+ * new checkpoints there. the columns after it shift by the change the
+ * edit made; once a tab is passed that change is a multiple of tabstop
+ * and stays one, so at most one more checkpoint gap is walked. returns
+ * false when the line must be rescanned instead: the edit adds or
+ * removes a newline, or the line is short.
+ */
+static bool
+infoline(struct editor *e, struct lineinfo *li, size_t at, const char *p, size_t n)
+{
+	struct infowalk w;
+	size_t a, b, k, end, m;
+	int d;
+
+	if (at < li->ls || (p ? memchr(p, '\n', n) != NULL : at + n > li->le))
+		return false;
+	if (li->nck == 0) {
+		/* a long line of plain ascii: it stays one unless p brings in more. */
+		if (!li->ascii || li->tabs || li->le - li->ls <= lineslong)
+			return false;
+		for (k = 0; p && k < n; k++) {
+			if ((unsigned char)p[k] >= 0x80 || p[k] == '\t')
+				return false;
+		}
+		li->le = p ? li->le + n : li->le - n;
+		li->width = p ? li->width + (int)n : li->width - (int)n;
+		return true;
+	}
+
+	/* a: the last checkpoint before the edit; b: the first after it that surely starts a column. */
+	end = p ? at : at + n;
+	for (a = 0; a + 1 < li->nck && li->ck[a + 1].off < at; a++)
+		;
+	for (b = a + 1; b < li->nck && li->ck[b].off < end; b++)
+		;
+	while (b < li->nck && isutfcont((unsigned char)textbyte(e, li->ck[b].off)))
+		b++;
+
+	memset(&w, 0, sizeof(w));
+	w.off = li->ck[a].off;
+	w.col = li->ck[a].col;
+	w.step = true;
+	w.next = w.off + linesckpt;
+	walktext(e, &w, li->ck[a].off, at);
+	if (p)
+		walkbytes(&w, (const unsigned char *)p, n);
+	walktext(e, &w, end, b < li->nck ? li->ck[b].off : li->le);
+	li->ck[a].tab = w.tab;
+
+	d = b < li->nck ? w.col - li->ck[b].col : 0;
+	for (k = b; k < li->nck; k++) {
+		li->ck[k].col += d;
+		if (d % tabstop && li->ck[k].tab) {
+			struct infowalk t;
+			size_t stop;
+			int old;
+
+			/* the first tab after the edit: find the shift past it. */
+			memset(&t, 0, sizeof(t));
+			t.col = li->ck[k].col;
+			t.step = true;
+			t.next = (size_t)-1;
+			stop = k + 1 < li->nck ? li->ck[k + 1].off : li->le;
+			walktext(e, &t, li->ck[k].off, stop);
+			old = k + 1 < li->nck ? li->ck[k + 1].col : li->width;
+			d = t.col - old;
+		}
+		li->ck[k].off = p ? li->ck[k].off + n : li->ck[k].off - n;
+	}
+	li->width = b < li->nck ? li->width + d : w.col;
+
+	/* splice: [0,a], the new checkpoints, then [b,nck). */
+	m = a + 1 + w.nck + (li->nck - b);
+	if (m > li->ckcap) {
+		struct linecheck *nck;
+
+		nck = realloc(li->ck, m * sizeof(li->ck[0]));
+		if (!nck)
+			die("out of memory");
+		li->ck = nck;
+		li->ckcap = m;
+	}
+	memmove(li->ck + a + 1 + w.nck, li->ck + b, (li->nck - b) * sizeof(li->ck[0]));
+	if (w.nck)
+		memcpy(li->ck + a + 1, w.ck, w.nck * sizeof(li->ck[0]));
+	li->nck = m;
+	free(w.ck);
+
+	li->le = p ? li->le + n : li->le - n;
+	for (k = 0; p && k < n; k++) {
+		if ((unsigned char)p[k] >= 0x80)
+			li->ascii = false;
+		if (p[k] == '\t')
+			li->tabs = true;
+	}
+	return true;
+}
+
+/*
+ * infoedit carries the line info cache over an edit (as in curedit, once
+ * editgen is bumped). lines wholly before the edit are kept, lines wholly
+ * after it move by n, and the line holding it is patched (infoline) or
+ * dropped. moved entries
+ * are put back in the slots of their new starts; when two want the same
+ * slot, the one already there keeps it.
+ */
+static void
+infoedit(struct editor *e, size_t at, const char *p, size_t n)
+{
+	struct lineinfo *li, t;
+	size_t i, k, c;
+
+	if (!e->lineinfo)
+		return;
+	for (i = 0; i < linesinfos; i++) {
+		li = &e->lineinfo[i];
+		if (li->gen != e->editgen - 1)
+			continue;
+		if (at > li->le) {
+			li->gen = e->editgen;
+		} else if (p ? at < li->ls : at + n < li->ls) {
+			li->ls = p ? li->ls + n : li->ls - n;
+			li->le = p ? li->le + n : li->le - n;
+			for (c = 0; c < li->nck; c++)
+				li->ck[c].off = p ? li->ck[c].off + n : li->ck[c].off - n;
+			li->gen = e->editgen;
+		} else if (infoline(e, li, at, p, n)) {
+			li->gen = e->editgen;
+		}
+	}
+	for (i = 0; i < linesinfos; i++) {
+		for (;;) {
+			li = &e->lineinfo[i];
+			if (li->gen != e->editgen || (k = infoslot(li->ls)) == i)
+				break;
+			if (e->lineinfo[k].gen == e->editgen && infoslot(e->lineinfo[k].ls) == k) {
+				li->gen = 0;
+				break;
+			}
+			t = e->lineinfo[k];
+			e->lineinfo[k] = *li;
+			*li = t;
+		}
+	}
+}
+
+/*
+ * curedit bumps the edit generation for n bytes p about to be inserted at
+ * at (or, with p NULL, deleted there). the cursor cache is rebased when
+ * the edit lies wholly before or after the cursor's line, else dropped;
+ * the line info cache is carried over the same way (infoedit).
+ */
+static void
+curedit(struct editor *e, size_t at, const char *p, size_t n)
+{
+	size_t nl, i;
+	bool keep;
+
+	keep = false;
+	if (e->cgen == e->editgen) {
+		if (at > e->cle) {
+			keep = true;
+		} else if (p && at < e->cls) {
+			nl = countnl(p, n);
+			e->cpos += n;
+			e->cls += n;
+			e->cle += n;
+			e->crow += nl;
+			keep = true;
+		} else if (!p && at + n < e->cls) {
+			nl = 0;
+			for (i = at; i < at + n; ) {
+				const char *s;
+				size_t k;
+
+				s = textspan(e, i, &k);
+				if (k > at + n - i)
+					k = at + n - i;
+				nl += countnl(s, k);
+				i += k;
+			}
+			e->cpos -= n;
+			e->cls -= n;
+			e->cle -= n;
+			e->crow -= nl;
+			keep = true;
+		}
+	}
+	e->editgen++;
+	if (keep)
+		e->cgen = e->editgen;
+	infoedit(e, at, p, n);
+}
+
+/*
+ * linesins patches the line table for n bytes p about to be inserted at at.
+ * backends call it (and linesdel) before touching the buffer, so a running
+ * indexer is stopped first; past the indexed prefix there is nothing to patch.
+ * the line holding at grows by n, or is split at the newlines in p, so an
+ * edit costs one block and O(log lines) tree updates instead of a rescan.
+ */
+void
+linesins(struct editor *e, size_t at, const char *p, size_t n)
+{
+	struct linetab *t;
+	size_t row, ls, le, add, i;
+	size_t *len;
+	int bi, j;
+
+	curedit(e, at, p, n);
+	linesjoin(e, true);
+	if (e->linedirty || e->linelen == 0 || n == 0)
+		return;
+	if (e->linepart) {
+		if (at >= e->linefront)
+			return;
+		e->linefront += n;
+	}
+	t = e->linetab;
+	row = tabrow(t, at, &bi, &j, &ls);
+	le = ls + blkget(t->b[bi], j) + n;
+	add = countnl(p, n);
+	len = malloc((add + 1) * sizeof(len[0]));
+	if (!len)
+		die("out of memory");
+	listnl(p, n, at, len);
+	len[add] = le;
+	for (i = add; i > 0; i--)
+		len[i] -= len[i - 1];
+	len[0] -= ls;
+	tabsplice(t, row, 1, len, add + 1);
+	free(len);
+	e->linelen += add;
+}
+
+/* linesdel patches the line table for n bytes about to be deleted at at. */
+void
+linesdel(struct editor *e, size_t at, size_t n)
+{
+	struct linetab *t;
+	size_t a, b, sa, sb, len;
+	int bi, j;
+
+	curedit(e, at, NULL, n);
+	linesjoin(e, true);
+	if (e->linedirty || e->linelen == 0 || n == 0)
+		return;
+	t = e->linetab;
+	if (e->linepart) {
+		if (at >= e->linefront)
+			return;
+		if (at + n > e->linefront) {
+			/* the prefix now ends at at, inside the line holding it. */
+			a = tabrow(t, at, &bi, &j, &sa);
+			len = at - sa;
+			tabsplice(t, a, e->linelen - a, &len, 1);
+			e->linelen = a + 1;
+			e->linefront = at;
+			return;
+		}
+		e->linefront -= n;
+	}
+	a = tabrow(t, at, &bi, &j, &sa);
+	b = tabrow(t, at + n, &bi, &j, &sb);
+	len = (at - sa) + (sb + blkget(t->b[bi], j) - at - n);
+	tabsplice(t, a, b - a + 1, &len, 1);
+	e->linelen -= b - a;
+}
+
+/*
+ * linesfind sets *ls and *le to the start and end of the line holding at,
+ * from the line index. the last line found is kept until the next edit,
+ * so repeated calls on the cursor's line cost nothing. returns false
+ * while the background indexer has not reached the whole line yet.
+ */
+static bool
+linesfind(struct editor *e, size_t at, size_t *ls, size_t *le)
+{
+	struct lineidx *x;
+	size_t row, len;
+	int bi, j;
+	bool ok;
+
+	len = textlen(e);
+	if (at > len)
+		at = len;
+	if (e->linegen == e->editgen && e->linels <= at && at <= e->linele) {
+		*ls = e->linels;
+		*le = e->linele;
+		return true;
+	}
+#ifdef TEXT_nl
+	if (textnl(e)) {
+		row = textnlbefore(e, at);
+		*ls = row2off(e, row);
+		*le = textnlpos(e, row + 1);
+		goto found;
+	}
+#endif
+	linesensure(e);
+	x = e->lineidx;
+	if (x) {
+		pthread_mutex_lock(&x->mu);
+		if (x->fin) {
+			pthread_mutex_unlock(&x->mu);
+			linesjoin(e, false);
+			x = NULL;
+		}
+	}
+	row = tabrow(e->linetab, at, &bi, &j, ls);
+	ok = row + 1 < e->linelen;
+	if (ok)
+		*le = *ls + blkget(e->linetab->b[bi], j) - 1;
+	if (x) {
+		pthread_mutex_unlock(&x->mu);
+		if (!ok)
+			return false;
+	} else if (!ok) {
+		*le = len;
+	}
+#ifdef TEXT_nl
+found:
+#endif
+	e->linels = *ls;
+	e->linele = *le;
+	e->linegen = e->editgen;
+	return true;
 }
 
 /* linestart returns the offset of the start of the line containing at. */
 size_t
 linestart(struct editor *e, size_t at)
 {
-	while (at > 0 && e->buf.s[at - 1] != '\n')
-		at--;
-	return at;
+	size_t ls, le;
+
+	if (linesfind(e, at, &ls, &le))
+		return ls;
+	/* not indexed yet: scan for the newline before at. */
+	while (at > 0) {
+		size_t b, i, nl;
+		bool found;
+
+		/* search back a block at a time, scanning its spans forward. */
+		b = at > linesblock ? at - linesblock : 0;
+		found = false;
+		nl = 0;
+		for (i = b; i < at; ) {
+			const char *s, *q;
+			size_t k;
+
+			s = textspan(e, i, &k);
+			if (k > at - i)
+				k = at - i;
+			q = lastnl(s, k);
+			if (q) {
+				nl = i + (size_t)(q - s);
+				found = true;
+			}
+			i += k;
+		}
+		if (found)
+			return nl + 1;
+		at = b;
+	}
+	return 0;
 }
 
 /* lineend returns the offset of the end of the line containing at. */
 size_t
 lineend(struct editor *e, size_t at)
 {
-	while (at < e->buf.len && e->buf.s[at] != '\n')
-		at++;
+	size_t ls, le, len;
+
+	if (linesfind(e, at, &ls, &le))
+		return le;
+	len = textlen(e);
+	while (at < len) {
+		const char *s, *q;
+		size_t k;
+
+		s = textspan(e, at, &k);
+		q = firstnl(s, k);
+		if (q)
+			return at + (size_t)(q - s);
+		at += k;
+	}
 	return at;
 }
 
 /* linecount returns the number of lines in the buffer (>= 1). */
-int
+size_t
 linecount(struct editor *e)
 {
+#ifdef TEXT_nl
+	if (textnl(e))
+		return textnlcount(e) + 1;
+#endif
 	linesensure(e);
+	linesjoin(e, false);
 	return e->linelen;
 }
 
 /* off2row maps a byte offset to a 0-based row index. */
-int
+size_t
 off2row(struct editor *e, size_t off)
 {
-	size_t lo, hi;
+	size_t row, ls;
+	int bi, j;
 
-	linesensure(e);
-	if (off > e->buf.len)
-		off = e->buf.len;
-	if (e->linelen <= 1)
+#ifdef TEXT_nl
+	if (textnl(e))
+		return textnlbefore(e, off);
+#endif
+	if (off > textlen(e))
+		off = textlen(e);
+	lineslock(e, 0, off);
+	row = tabrow(e->linetab, off, &bi, &j, &ls);
+	linesunlock(e);
+	return row;
+}
+
+/* row2off maps a 0-based row index to its starting byte offset. */
+size_t
+row2off(struct editor *e, size_t row)
+{
+	size_t off;
+	int bi, j;
+
+#ifdef TEXT_nl
+	if (textnl(e)) {
+		size_t nl;
+
+		if (row == 0)
+			return 0;
+		nl = textnlpos(e, row);
+		return nl < textlen(e) ? nl + 1 : nl;
+	}
+#endif
+	if (row == 0)
 		return 0;
+	lineslock(e, row, 0);
+	off = row >= e->linelen ? textlen(e) : taboff(e->linetab, row, &bi, &j);
+	linesunlock(e);
+	return off;
+}
+
+/* linesmark records a checkpoint at off, column col. */
+static void
+linesmark(struct lineinfo *li, size_t off, int col)
+{
+	if (li->nck == li->ckcap) {
+		struct linecheck *nck;
+		size_t nc;
+
+		nc = li->ckcap ? li->ckcap * 2 : 64;
+		nck = realloc(li->ck, nc * sizeof(li->ck[0]));
+		if (!nck)
+			die("out of memory");
+		li->ck = nck;
+		li->ckcap = nc;
+	}
+	li->ck[li->nck].off = off;
+	li->ck[li->nck].col = col;
+	li->ck[li->nck].tab = false;
+	li->nck++;
+}
+
+/*
+ * linesinfo returns what is known about the line starting at ls, scanning
+ * it once and again only when an edit lands in it (infoedit). entries live
+ * in a small direct-mapped cache keyed by line start, so the lines on
+ * screen and around the cursor stay hot.
+ */
+static const struct lineinfo *
+linesinfo(struct editor *e, size_t ls)
+{
+	struct lineinfo *li;
+	size_t i, next;
+	int col;
+	bool step, mark;
+
+	if (!e->lineinfo) {
+		e->lineinfo = calloc(linesinfos, sizeof(e->lineinfo[0]));
+		if (!e->lineinfo)
+			die("out of memory");
+	}
+	li = &e->lineinfo[infoslot(ls)];
+	if (li->gen == e->editgen && li->ls == ls)
+		return li;
+
+	li->gen = e->editgen;
+	li->ls = ls;
+	li->le = lineend(e, ls);
+	li->ascii = true;
+	li->tabs = false;
+	li->nck = 0;
+	mark = li->le - ls > lineslong;
+	next = ls;
+	col = 0;
+	step = true;
+	for (i = ls; i < li->le; ) {
+		const unsigned char *s;
+		size_t k, j;
+
+		s = (const unsigned char *)textspan(e, i, &k);
+		if (k > li->le - i)
+			k = li->le - i;
+		/*
+		 * the same steps as off2col: a tab, or a byte and the continuation
+		 * bytes after it (so a stray one at the start or after a tab counts).
+		 */
+		for (j = 0; j < k; j++) {
+			if (s[j] >= 0x80)
+				li->ascii = false;
+			if (s[j] != '\t' && !step && isutfcont(s[j]))
+				continue;
+			if (mark && i + j >= next) {
+				linesmark(li, i + j, col);
+				next = i + j + linesckpt;
+			}
+			if (s[j] == '\t') {
+				li->tabs = true;
+				if (li->nck)
+					li->ck[li->nck - 1].tab = true;
+				col += tabstop - (col % tabstop);
+				step = true;
+			} else {
+				col++;
+				step = false;
+			}
+		}
+		i += k;
+	}
+	li->width = col;
+	if (li->ascii && !li->tabs)
+		li->nck = 0;
+	return li;
+}
+
+/* linesbyoff returns the last checkpoint at or before off (NULL if none). */
+static const struct linecheck *
+linesbyoff(const struct lineinfo *li, size_t off)
+{
+	size_t lo, hi;
+
+	if (li->nck == 0 || li->ck[0].off > off)
+		return NULL;
+	lo = 0;
+	hi = li->nck;
+	while (lo + 1 < hi) {
+		size_t mid;
+
+		mid = lo + (hi - lo) / 2;
+		if (li->ck[mid].off <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return &li->ck[lo];
+}
 
+/* linesbycol returns the last checkpoint at or before column col (NULL if none). */
+static const struct linecheck *
+linesbycol(const struct lineinfo *li, int col)
+{
+	size_t lo, hi;
+
+	if (li->nck == 0 || li->ck[0].col > col)
+		return NULL;
 	lo = 0;
-	hi = (size_t)e->linelen;
+	hi = li->nck;
 	while (lo + 1 < hi) {
 		size_t mid;
 
 		mid = lo + (hi - lo) / 2;
-		if (e->linest[mid] <= off)
+		if (li->ck[mid].col <= col)
 			lo = mid;
 		else
 			hi = mid;
 	}
-	return (int)lo;
+	return &li->ck[lo];
 }
 
 /* off2col maps a byte offset to a display column (tabs expanded). */
 int
 off2col(struct editor *e, size_t off)
 {
+	const struct lineinfo *li;
+	const struct linecheck *ck;
 	size_t ls;
 	size_t i;
 	int col;
 
 	ls = linestart(e, off);
+	li = linesinfo(e, ls);
+	if (off >= li->le)
+		return li->width;
+	if (li->ascii && !li->tabs)
+		return (int)(off - ls);
 	col = 0;
 	i = ls;
-	while (i < off && i < e->buf.len && e->buf.s[i] != '\n') {
-		unsigned char c;
+	ck = linesbyoff(li, off);
+	if (ck) {
+		i = ck->off;
+		col = ck->col;
+	}
+	while (i < off && i < textlen(e) && textbyte(e, i) != '\n') {
+		int c;
 		size_t j;
 
-		c = (unsigned char)e->buf.s[i];
+		c = textbyte(e, i);
 		if (c == '\t') {
 			col += tabstop - (col % tabstop);
 			i++;
 			continue;
 		}
-		j = utfnext(e->buf.s, e->buf.len, i);
+		j = textnext(e, i);
 		if (j <= i)
 			j = i + 1;
 		col++;
@@ -154,72 +1634,142 @@ off2col(struct editor *e, size_t off)
 	return col;
 }
 
-/* offatcol maps a desired display column to a byte offset within [ls,le]. */
+/*
+ * colseek returns the offset in [ls,le] where display column want starts
+ * (or the tab covering it, or le), with its column in *col. columns only
+ * grow along a line, so the walk may start at any checkpoint before want.
+ */
 size_t
-offatcol(struct editor *e, size_t ls, size_t le, int want)
+colseek(struct editor *e, size_t ls, size_t le, int want, int *col)
 {
+	const struct lineinfo *li;
+	const struct linecheck *ck;
 	size_t i;
-	int col;
+	int c;
 
+	*col = 0;
 	if (want <= 0)
 		return ls;
-	col = 0;
+	li = linesinfo(e, ls);
+	ck = NULL;
+	if (li->le == le) {
+		if (want >= li->width) {
+			*col = li->width;
+			return le;
+		}
+		if (li->ascii && !li->tabs) {
+			*col = want;
+			return ls + (size_t)want;
+		}
+		ck = linesbycol(li, want);
+	}
+	c = 0;
 	i = ls;
-	while (i < le && i < e->buf.len && e->buf.s[i] != '\n') {
-		unsigned char c;
+	if (ck) {
+		i = ck->off;
+		c = ck->col;
+	}
+	while (i < le && i < textlen(e) && textbyte(e, i) != '\n') {
+		int b;
 		size_t j;
 		int n;
 
-		if (col >= want)
+		if (c >= want)
 			break;
-		c = (unsigned char)e->buf.s[i];
-		if (c == '\t') {
-			n = tabstop - (col % tabstop);
-			if (col + n > want)
+		b = textbyte(e, i);
+		if (b == '\t') {
+			n = tabstop - (c % tabstop);
+			if (c + n > want)
 				break;
-			col += n;
+			c += n;
 			i++;
 			continue;
 		}
-		j = utfnext(e->buf.s, e->buf.len, i);
+		j = textnext(e, i);
 		if (j <= i)
 			j = i + 1;
-		col++;
+		c++;
 		i = j;
 	}
+	*col = c;
 	return i;
 }
 
-/* row2off maps a 0-based row index to its starting byte offset. */
+/* offatcol maps a desired display column to a byte offset within [ls,le]. */
 size_t
-row2off(struct editor *e, int row)
+offatcol(struct editor *e, size_t ls, size_t le, int want)
 {
-	linesensure(e);
-	if (row <= 0)
-		return 0;
-	if (row >= e->linelen)
-		return e->buf.len;
-	return e->linest[row];
+	int col;
+
+	return colseek(e, ls, le, want, &col);
+}
+
+/*
+ * cursync brings the cursor cache up to date with E.cur. after a motion
+ * within the cached line only the column is redone; a move to the next or
+ * previous line (as left in the linestart cache by j and k) adjusts the
+ * row by one; anything else looks the row up in the index.
+ */
+static void
+cursync(struct editor *e)
+{
+	size_t at, ls;
+
+	at = e->cur;
+	if (e->cgen == e->editgen && e->cpos == at)
+		return;
+	if (e->cgen == e->editgen && at >= e->cls && at <= e->cle) {
+		/* same line. */
+	} else if (e->cgen == e->editgen && (ls = linestart(e, at)) == e->cle + 1) {
+		e->crow++;
+		e->cls = ls;
+		e->cle = lineend(e, ls);
+	} else if (e->cgen == e->editgen && e->cls > 0 && lineend(e, at) + 1 == e->cls) {
+		e->crow--;
+		e->cle = e->cls - 1;
+		e->cls = linestart(e, at);
+	} else {
+		e->crow = off2row(e, at);
+		e->cls = linestart(e, at);
+		e->cle = lineend(e, at);
+	}
+	e->ccol = off2col(e, at);
+	e->cpos = at;
+	e->cgen = e->editgen;
+}
+
+/* currow returns the cursor's 0-based row. */
+size_t
+currow(struct editor *e)
+{
+	cursync(e);
+	return e->crow;
+}
+
+/* curcol returns the cursor's display column. */
+int
+curcol(struct editor *e)
+{
+	cursync(e);
+	return e->ccol;
 }
 
 /* clampcur keeps E.cur in-range and on a utf-8 lead byte. */
 void
 clampcur(struct editor *e)
 {
-	if (e->cur > e->buf.len)
-		e->cur = e->buf.len;
-	if (e->cur < e->buf.len && isutfcont((unsigned char)e->buf.s[e->cur]))
-		e->cur = utfprev(e->buf.s, e->buf.len, e->cur);
+	if (e->cur > textlen(e))
+		e->cur = textlen(e);
+	if (e->cur < textlen(e) && isutfcont((unsigned char)textbyte(e, e->cur)))
+		e->cur = textprev(e, e->cur);
 }
 
 /* ndigits returns the number of decimal digits in n (>= 1). */
 static int
-ndigits(int n)
+ndigits(size_t n)
 {
 	int d;
 
-	if (n < 0)
-		n = -n;
 	d = 1;
 	while (n >= 10) {
 		n /= 10;
@@ -228,11 +1778,45 @@ ndigits(int n)
 	return d;
 }
 
+/* linesguess returns the line count, extrapolated from the indexed prefix while indexing. */
+static size_t
+linesguess(struct editor *e)
+{
+	struct lineidx *x;
+	double n;
+
+#ifdef TEXT_nl
+	int pct;
+
+	/* a paged file's newlines are still being counted: scale up the counted part. */
+	if (textnl(e) && (pct = textnlprogress(e)) >= 0) {
+		size_t at;
+
+		at = textlen(e) / 100 * (size_t)pct;
+		if (at == 0)
+			return 1;
+		n = (double)textnlbefore(e, at) * ((double)textlen(e) / (double)at);
+		return (size_t)n + 1;
+	}
+#endif
+	if (e->linepart)
+		linesensure(e);
+	x = e->lineidx;
+	if (!x)
+		return linecount(e);
+	pthread_mutex_lock(&x->mu);
+	n = (double)e->linelen;
+	if (x->done > 0)
+		n = n * ((double)x->len / (double)x->done);
+	pthread_mutex_unlock(&x->mu);
+	return (size_t)n;
+}
+
 /* numw returns the width of the line-number gutter (0 if disabled). */
 int
 numw(struct editor *e)
 {
 	if (!e->shownum)
 		return 0;
-	return ndigits(linecount(e)) + 1; /* digits + space */
+	return ndigits(linesguess(e)) + 1; /* digits + space */
 }
@@ -6,8 +6,20 @@
 /* linesdirty marks the line-start cache as needing a rebuild. */
 void linesdirty(struct editor *e);
 
+/* linesins patches the line-start cache for n bytes p about to be inserted at at. */
+void linesins(struct editor *e, size_t at, const char *p, size_t n);
+
+/* linesdel patches the line-start cache for n bytes about to be deleted at at. */
+void linesdel(struct editor *e, size_t at, size_t n);
+
+/* linesbusy reports whether the line index is still being built in the background. */
+bool linesbusy(struct editor *e);
+
+/* linesprogress returns how much of the buffer is indexed (0-99), or -1 when done. */
+int linesprogress(struct editor *e);
+
 /* linecount returns the number of lines in the buffer (>= 1). */
-int linecount(struct editor *e);
+size_t linecount(struct editor *e);
 
 /* linestart returns the offset of the start of the line containing at. */
 size_t linestart(struct editor *e, size_t at);
@@ -16,17 +28,26 @@ size_t linestart(struct editor *e, size_t at);
 size_t lineend(struct editor *e, size_t at);
 
 /* off2row maps a byte offset to a 0-based row index. */
-int off2row(struct editor *e, size_t off);
+size_t off2row(struct editor *e, size_t off);
 
 /* row2off maps a 0-based row index to its starting byte offset. */
-size_t row2off(struct editor *e, int row);
+size_t row2off(struct editor *e, size_t row);
 
 /* off2col maps a byte offset to a display column (tabs expanded). */
 int off2col(struct editor *e, size_t off);
 
+/* colseek returns the offset in [ls,le] where display column want starts (or the tab covering it, or le), with its column in *col. */
+size_t colseek(struct editor *e, size_t ls, size_t le, int want, int *col);
+
 /* offatcol maps a desired display column to a byte offset within [ls,le]. */
 size_t offatcol(struct editor *e, size_t ls, size_t le, int want);
 
+/* currow returns the cursor's 0-based row. */
+size_t currow(struct editor *e);
+
+/* curcol returns the cursor's display column. */
+int curcol(struct editor *e);
+
 /* clampcur keeps E.cur in-range and on a utf-8 lead byte. */
 void clampcur(struct editor *e);
 
@@ -2,12 +2,14 @@
 
 #include "edit.h"
 #include "ex.h"
+#include "job.h"
 #include "lines.h"
+#include "render.h"
 #include "sbuf.h"
 #include "status.h"
 #include "term.h"
+#include "text.h"
 #include "undo.h"
-#include "utf.h"
 
 /*
  * mode state machine.
@@ -30,11 +32,11 @@ cmdkey(struct editor *e, struct key k)
 	case kbs:
 	case 8:
 		if (e->cmd.len)
-			sbufsetlen(NULL, &e->cmd, e->cmd.len - 1);
+			sbufsetlen(&e->cmd, e->cmd.len - 1);
 		break;
 	default:
 		if (k.key >= 32 && k.key <= 255 && k.n > 0)
-			sbufins(NULL, &e->cmd, e->cmd.len, (char *)k.b, (size_t)k.n);
+			sbufins(&e->cmd, e->cmd.len, (char *)k.b, (size_t)k.n);
 		break;
 	}
 }
@@ -115,7 +117,7 @@ normkey(struct editor *e, int key)
 
 			a = linestart(e, e->cur);
 			b = lineend(e, e->cur);
-			if (b < e->buf.len && e->buf.s[b] == '\n')
+			if (b < textlen(e) && textbyte(e, b) == '\n')
 				b++;
 			yankset(e, a, b, true);
 			bufdelrange(e, a, b);
@@ -130,7 +132,7 @@ normkey(struct editor *e, int key)
 
 			a = linestart(e, e->cur);
 			b = lineend(e, e->cur);
-			if (b < e->buf.len && e->buf.s[b] == '\n')
+			if (b < textlen(e) && textbyte(e, b) == '\n')
 				b++;
 			yankset(e, a, b, true);
 			setstatus(e, "yanked line");
@@ -146,7 +148,7 @@ normkey(struct editor *e, int key)
 		e->prevmode = e->mode;
 		e->mode = mcmd;
 		e->cmdpre = ':';
-		sbufsetlen(NULL, &e->cmd, 0);
+		sbufsetlen(&e->cmd, 0);
 		setstatus(e, "CMD");
 		normreset(e);
 		break;
@@ -159,7 +161,7 @@ normkey(struct editor *e, int key)
 		e->prevmode = e->mode;
 		e->mode = mcmd;
 		e->cmdpre = '/';
-		sbufsetlen(NULL, &e->cmd, 0);
+		sbufsetlen(&e->cmd, 0);
 		setstatus(e, "/");
 		normreset(e);
 		break;
@@ -174,6 +176,9 @@ normkey(struct editor *e, int key)
 	case kesc:
 		normreset(e);
 		break;
+	case 12: /* ^L */
+		redrawall();
+		break;
 	case kleft: applymotion(e, 'h'); break;
 	case kright: applymotion(e, 'l'); break;
 	case kup: applymotion(e, 'k'); break;
@@ -250,7 +255,7 @@ viskey(struct editor *e, int key)
 		e->prevmode = e->mode;
 		e->mode = mcmd;
 		e->cmdpre = ':';
-		sbufsetlen(NULL, &e->cmd, 0);
+		sbufsetlen(&e->cmd, 0);
 		setstatus(e, "CMD");
 		normreset(e);
 		break;
@@ -258,7 +263,7 @@ viskey(struct editor *e, int key)
 		e->prevmode = e->mode;
 		e->mode = mcmd;
 		e->cmdpre = '/';
-		sbufsetlen(NULL, &e->cmd, 0);
+		sbufsetlen(&e->cmd, 0);
 		setstatus(e, "/");
 		normreset(e);
 		break;
@@ -298,8 +303,8 @@ inskey(struct editor *e, struct key k)
 	switch (k.key) {
 	case kesc:
 		e->mode = mnormal;
-		if (e->cur > 0 && e->buf.s[e->cur - 1] != '\n')
-			e->cur = utfprev(e->buf.s, e->buf.len, e->cur);
+		if (e->cur > 0 && textbyte(e, e->cur - 1) != '\n')
+			e->cur = textprev(e, e->cur);
 		setstatus(e, "NORMAL");
 		break;
 	case kenter:
@@ -334,7 +339,7 @@ inskey(struct editor *e, struct key k)
 
 			cur = e->cur;
 			undopushins(e, e->cur, k.b, (size_t)k.n, cur, true);
-			sbufins(e, &e->buf, e->cur, (char *)k.b, (size_t)k.n);
+			bufins(e, e->cur, (char *)k.b, (size_t)k.n);
 			e->cur += (size_t)k.n;
 			e->dirty = true;
 			clamp = false;
@@ -345,6 +350,34 @@ inskey(struct editor *e, struct key k)
 		clampcur(e);
 }
 
+/* pastekey inserts a bracketed paste at the cursor as one undo step. */
+static void
+pastekey(struct editor *e)
+{
+	const char *s;
+	size_t n, i;
+
+	s = termpaste(&n);
+	switch (e->mode) {
+	case mcmd:
+		/* up to the first newline, without control bytes other than tab. */
+		for (i = 0; i < n && s[i] != '\n'; i++) {
+			if ((unsigned char)s[i] >= 32 || s[i] == '\t')
+				sbufins(&e->cmd, e->cmd.len, s + i, 1);
+		}
+		break;
+	case mvisual:
+		setstatus(e, "paste ignored in VISUAL");
+		break;
+	default:
+		bufinsert(e, e->cur, s, n);
+		e->cur += n;
+		if (e->mode == mnormal)
+			clampcur(e);
+		break;
+	}
+}
+
 /* processkey reads a key and dispatches based on the current mode. */
 void
 processkey(struct editor *e)
@@ -361,6 +394,14 @@ processkey(struct editor *e)
 		write(STDOUT_FILENO, "\x1b[2J\x1b[H", 7);
 		exit(0);
 	}
+	if (key == kpaste) {
+		pastekey(e);
+		return;
+	}
+	if (key == 3 && e->job) {
+		jobstop(e);
+		return;
+	}
 
 	switch (e->mode) {
 	case mnormal:
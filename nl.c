@@ -0,0 +1,290 @@
+#include "nl.h"
+
+/*
+ * newline scanning kernels.
+ *
+ * on x86 the kernels compare 16 bytes per step with sse2 (always present on
+ * x86-64), or 32 with avx2 when the cpu has it; the choice is made by
+ * nlinit (or on first use). elsewhere they fall back to memchr and byte loops.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define NL_X86
+#include <immintrin.h>
+#endif
+
+struct nlops {
+	size_t (*count)(const char *s, size_t n);
+	const char *(*first)(const char *s, size_t n);
+	const char *(*last)(const char *s, size_t n);
+	size_t (*list)(const char *s, size_t n, size_t base, size_t *out);
+};
+
+/* countscalar is the portable countnl. */
+static size_t
+countscalar(const char *s, size_t n)
+{
+	const char *p, *end;
+	size_t c;
+
+	c = 0;
+	end = s + n;
+	for (p = s; (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+		c++;
+	return c;
+}
+
+/* firstscalar is the portable firstnl. */
+static const char *
+firstscalar(const char *s, size_t n)
+{
+	return memchr(s, '\n', n);
+}
+
+/* lastscalar is the portable lastnl. */
+static const char *
+lastscalar(const char *s, size_t n)
+{
+	while (n > 0)
+		if (s[--n] == '\n')
+			return s + n;
+	return NULL;
+}
+
+/* listscalar is the portable listnl. */
+static size_t
+listscalar(const char *s, size_t n, size_t base, size_t *out)
+{
+	const char *p, *end;
+	size_t c;
+
+	c = 0;
+	end = s + n;
+	for (p = s; (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+		out[c++] = base + (size_t)(p - s) + 1;
+	return c;
+}
+
+static const struct nlops scalarops = {
+	countscalar, firstscalar, lastscalar, listscalar,
+};
+
+#ifdef NL_X86
+/* countsse2 counts newlines 16 bytes at a time. */
+static size_t
+countsse2(const char *s, size_t n)
+{
+	__m128i nl, acc;
+	size_t c, i, k;
+
+	nl = _mm_set1_epi8('\n');
+	c = 0;
+	i = 0;
+	while (n - i >= 16) {
+		/* byte lanes count up to 255 matches before they are summed. */
+		acc = _mm_setzero_si128();
+		for (k = 0; k < 255 && n - i >= 16; k++, i += 16)
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(
+			    _mm_loadu_si128((const __m128i *)(s + i)), nl));
+		acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+		c += (size_t)_mm_cvtsi128_si32(acc) + (size_t)_mm_extract_epi16(acc, 4);
+	}
+	return c + countscalar(s + i, n - i);
+}
+
+/* firstsse2 finds the first newline 16 bytes at a time. */
+static const char *
+firstsse2(const char *s, size_t n)
+{
+	__m128i nl;
+	unsigned m;
+	size_t i;
+
+	nl = _mm_set1_epi8('\n');
+	for (i = 0; i + 16 <= n; i += 16) {
+		m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+		    _mm_loadu_si128((const __m128i *)(s + i)), nl));
+		if (m)
+			return s + i + __builtin_ctz(m);
+	}
+	return firstscalar(s + i, n - i);
+}
+
+/* lastsse2 finds the last newline 16 bytes at a time. */
+static const char *
+lastsse2(const char *s, size_t n)
+{
+	__m128i nl;
+	unsigned m;
+
+	nl = _mm_set1_epi8('\n');
+	while (n >= 16) {
+		n -= 16;
+		m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+		    _mm_loadu_si128((const __m128i *)(s + n)), nl));
+		if (m)
+			return s + n + 31 - __builtin_clz(m);
+	}
+	return lastscalar(s, n);
+}
+
+/* listsse2 lists newline offsets 16 bytes at a time. */
+static size_t
+listsse2(const char *s, size_t n, size_t base, size_t *out)
+{
+	__m128i nl;
+	unsigned m;
+	size_t c, i;
+
+	nl = _mm_set1_epi8('\n');
+	c = 0;
+	for (i = 0; i + 16 <= n; i += 16) {
+		m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+		    _mm_loadu_si128((const __m128i *)(s + i)), nl));
+		for (; m; m &= m - 1)
+			out[c++] = base + i + (size_t)__builtin_ctz(m) + 1;
+	}
+	return c + listscalar(s + i, n - i, base + i, out + c);
+}
+
+static const struct nlops sse2ops = {
+	countsse2, firstsse2, lastsse2, listsse2,
+};
+
+/* countavx2 counts newlines 32 bytes at a time. */
+__attribute__((target("avx2")))
+static size_t
+countavx2(const char *s, size_t n)
+{
+	__m256i nl, acc;
+	uint64_t lane[4];
+	size_t c, i, k;
+
+	nl = _mm256_set1_epi8('\n');
+	c = 0;
+	i = 0;
+	while (n - i >= 32) {
+		acc = _mm256_setzero_si256();
+		for (k = 0; k < 255 && n - i >= 32; k++, i += 32)
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(
+			    _mm256_loadu_si256((const __m256i *)(s + i)), nl));
+		acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+		_mm256_storeu_si256((__m256i *)lane, acc);
+		c += (size_t)(lane[0] + lane[1] + lane[2] + lane[3]);
+	}
+	return c + countsse2(s + i, n - i);
+}
+
+/* firstavx2 finds the first newline 32 bytes at a time. */
+__attribute__((target("avx2")))
+static const char *
+firstavx2(const char *s, size_t n)
+{
+	__m256i nl;
+	unsigned m;
+	size_t i;
+
+	nl = _mm256_set1_epi8('\n');
+	for (i = 0; i + 32 <= n; i += 32) {
+		m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		    _mm256_loadu_si256((const __m256i *)(s + i)), nl));
+		if (m)
+			return s + i + __builtin_ctz(m);
+	}
+	return firstsse2(s + i, n - i);
+}
+
+/* lastavx2 finds the last newline 32 bytes at a time. */
+__attribute__((target("avx2")))
+static const char *
+lastavx2(const char *s, size_t n)
+{
+	__m256i nl;
+	unsigned m;
+
+	nl = _mm256_set1_epi8('\n');
+	while (n >= 32) {
+		n -= 32;
+		m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		    _mm256_loadu_si256((const __m256i *)(s + n)), nl));
+		if (m)
+			return s + n + 31 - __builtin_clz(m);
+	}
+	return lastsse2(s, n);
+}
+
+/* listavx2 lists newline offsets 32 bytes at a time. */
+__attribute__((target("avx2")))
+static size_t
+listavx2(const char *s, size_t n, size_t base, size_t *out)
+{
+	__m256i nl;
+	unsigned m;
+	size_t c, i;
+
+	nl = _mm256_set1_epi8('\n');
+	c = 0;
+	for (i = 0; i + 32 <= n; i += 32) {
+		m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		    _mm256_loadu_si256((const __m256i *)(s + i)), nl));
+		for (; m; m &= m - 1)
+			out[c++] = base + i + (size_t)__builtin_ctz(m) + 1;
+	}
+	return c + listsse2(s + i, n - i, base + i, out + c);
+}
+
+static const struct nlops avx2ops = {
+	countavx2, firstavx2, lastavx2, listavx2,
+};
+#endif
+
+static const struct nlops *ops;
+
+/* nlpick picks the kernels for this cpu on first use. */
+static const struct nlops *
+nlpick(void)
+{
+	if (ops)
+		return ops;
+	ops = &scalarops;
+#ifdef NL_X86
+	__builtin_cpu_init();
+	ops = __builtin_cpu_supports("avx2") ? &avx2ops : &sse2ops;
+#endif
+	return ops;
+}
+
+/* nlinit picks the kernels for this cpu; call it before starting threads. */
+void
+nlinit(void)
+{
+	(void)nlpick();
+}
+
+/* countnl returns the number of newlines in s[0,n). */
+size_t
+countnl(const char *s, size_t n)
+{
+	return nlpick()->count(s, n);
+}
+
+/* firstnl returns the first newline in s[0,n), or NULL. */
+const char *
+firstnl(const char *s, size_t n)
+{
+	return nlpick()->first(s, n);
+}
+
+/* lastnl returns the last newline in s[0,n), or NULL. */
+const char *
+lastnl(const char *s, size_t n)
+{
+	return nlpick()->last(s, n);
+}
+
+/* listnl stores base+i+1 in out for every newline s[i] (returns how many). */
+size_t
+listnl(const char *s, size_t n, size_t base, size_t *out)
+{
+	return nlpick()->list(s, n, base, out);
+}
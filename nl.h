@@ -0,0 +1,28 @@
+#ifndef NL_H
+#define NL_H
+
+#include "wee.h"
+
+/*
+ * newline scanning kernels.
+ *
+ * the line index, line motions and backends all count or locate newlines
+ * through these, so the fastest version for the cpu is picked in one place.
+ */
+
+/* nlinit picks the kernels for this cpu; call it before starting threads. */
+void nlinit(void);
+
+/* countnl returns the number of newlines in s[0,n). */
+size_t countnl(const char *s, size_t n);
+
+/* firstnl returns the first newline in s[0,n), or NULL. */
+const char *firstnl(const char *s, size_t n);
+
+/* lastnl returns the last newline in s[0,n), or NULL. */
+const char *lastnl(const char *s, size_t n);
+
+/* listnl stores base+i+1 in out for every newline s[i] (returns how many). */
+size_t listnl(const char *s, size_t n, size_t base, size_t *out);
+
+#endif
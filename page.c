@@ -0,0 +1,338 @@
+#include "page.h"
+
+#include "nl.h"
+#include "text.h"
+#include "wee_util.h"
+
+/*
+ * windowed file pager.
+ *
+ * the file is cut into pagesz pages. pagewin of them are kept in memory
+ * and the least recently used one is reused on a miss. nlpre holds the
+ * newline count before every page, the sparse line index lines.c needs
+ * to find a row without reading the whole file again. a thread fills it
+ * in page order after open, and lookups wait only for the pages they
+ * need. it reads the file through a mapping when it can, dropping each
+ * page once counted, so the counting pass does not leave the whole file
+ * resident either.
+ */
+
+enum {
+	pagesz = 1 << 16,  /* bytes per page */
+	pagewin = 256,     /* resident pages */
+};
+
+struct slot {
+	size_t no;          /* page held (when s != NULL) */
+	unsigned long used; /* lru clock at last use */
+	char *s;
+};
+
+struct pager {
+	int fd;
+	size_t len;
+	size_t npg;
+	const char *map; /* the whole file for the counter, or NULL to pread it */
+	size_t *nlpre; /* nlpre[i]: newlines in pages [0,i), for i <= known */
+	struct slot w[pagewin];
+	size_t last;   /* slot of the latest hit */
+	unsigned long clock;
+
+	/* the counting thread publishes known under mu. */
+	pthread_t tid;
+	pthread_mutex_t mu;
+	pthread_cond_t cv;
+	size_t known;  /* pages counted */
+	int err;       /* errno of a failed read (counting stops) */
+	bool stop;
+	bool counting; /* tid was started and not yet joined */
+};
+
+/* pagelen returns the number of bytes in page no. */
+static size_t
+pagelen(struct pager *p, size_t no)
+{
+	size_t off;
+
+	off = no * pagesz;
+	return p->len - off < pagesz ? p->len - off : pagesz;
+}
+
+/* pageread reads n bytes at off into s (0 ok, -1 error). */
+static int
+pageread(int fd, char *s, size_t n, size_t off)
+{
+	while (n > 0) {
+		ssize_t r;
+
+		r = pread(fd, s, n, (off_t)off);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			if (r == 0)
+				errno = EIO;
+			return -1;
+		}
+		s += r;
+		off += (size_t)r;
+		n -= (size_t)r;
+	}
+	return 0;
+}
+
+/* pageload returns page no, reading it into the lru slot on a miss. */
+static const char *
+pageload(struct pager *p, size_t no)
+{
+	struct slot *w;
+	size_t i, old;
+
+	i = p->last;
+	w = &p->w[i];
+	if (!w->s || w->no != no) {
+		old = 0;
+		for (i = 0; i < pagewin; i++) {
+			if (p->w[i].s && p->w[i].no == no)
+				break;
+			if (p->w[i].used < p->w[old].used)
+				old = i;
+		}
+		if (i == pagewin) {
+			i = old;
+			w = &p->w[i];
+			if (!w->s) {
+				w->s = malloc(pagesz);
+				if (!w->s)
+					die("out of memory");
+			}
+			if (pageread(p->fd, w->s, pagelen(p, no), no * pagesz) == -1)
+				die("read file: %s", strerror(errno));
+			w->no = no;
+		}
+		w = &p->w[i];
+	}
+	w->used = ++p->clock;
+	p->last = i;
+	return w->s;
+}
+
+/* pagecounter counts the newlines of every page in order, publishing each count. */
+static void *
+pagecounter(void *arg)
+{
+	struct pager *p;
+	const char *s;
+	char *buf;
+	size_t i, nl;
+	bool stop;
+	int err;
+
+	p = arg;
+	buf = NULL;
+	if (!p->map) {
+		buf = malloc(pagesz);
+		if (!buf)
+			die("out of memory");
+		(void)posix_fadvise(p->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	err = 0;
+	for (i = 0; i < p->npg; i++) {
+		pthread_mutex_lock(&p->mu);
+		stop = p->stop;
+		pthread_mutex_unlock(&p->mu);
+		if (stop)
+			break;
+		s = p->map ? p->map + i * pagesz : buf;
+		if (!p->map && pageread(p->fd, buf, pagelen(p, i), i * pagesz) == -1) {
+			err = errno;
+			break;
+		}
+		nl = countnl(s, pagelen(p, i));
+		if (p->map)
+			(void)posix_madvise((void *)s, pagelen(p, i), POSIX_MADV_DONTNEED);
+		pthread_mutex_lock(&p->mu);
+		p->nlpre[i + 1] = p->nlpre[i] + nl;
+		p->known = i + 1;
+		pthread_cond_broadcast(&p->cv);
+		pthread_mutex_unlock(&p->mu);
+	}
+	if (!p->map)
+		(void)posix_fadvise(p->fd, 0, 0, POSIX_FADV_RANDOM);
+	textunmap(p->map, p->len);
+	p->map = NULL;
+	free(buf);
+	pthread_mutex_lock(&p->mu);
+	p->err = err;
+	p->stop = true;
+	pthread_cond_broadcast(&p->cv);
+	pthread_mutex_unlock(&p->mu);
+	return NULL;
+}
+
+/* pagewait waits until the first no pages are counted, or until more than nl newlines are. */
+static void
+pagewait(struct pager *p, size_t no, size_t nl)
+{
+	pthread_mutex_lock(&p->mu);
+	while (p->known < no && p->nlpre[p->known] <= nl && !p->stop)
+		pthread_cond_wait(&p->cv, &p->mu);
+	if (p->known < no && p->nlpre[p->known] <= nl)
+		die("read file: %s", strerror(p->err ? p->err : EIO));
+	pthread_mutex_unlock(&p->mu);
+}
+
+/* pagerank returns the number of newlines in [0,off). */
+static size_t
+pagerank(struct pager *p, size_t off)
+{
+	size_t no, k;
+
+	no = off / pagesz;
+	if (no >= p->npg) {
+		pagewait(p, p->npg, (size_t)-1);
+		return p->nlpre[p->npg];
+	}
+	pagewait(p, no, (size_t)-1);
+	k = off - no * pagesz;
+	if (k == 0)
+		return p->nlpre[no];
+	return p->nlpre[no] + countnl(pageload(p, no), k);
+}
+
+/* pageopen opens n bytes of fd (which it dups) and starts counting their newlines; NULL on error. */
+struct pager *
+pageopen(int fd, size_t n)
+{
+	struct pager *p;
+	int err;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		die("out of memory");
+	p->len = n;
+	p->npg = (n + pagesz - 1) / pagesz;
+	p->nlpre = malloc((p->npg + 1) * sizeof(p->nlpre[0]));
+	if (!p->nlpre)
+		die("out of memory");
+	p->nlpre[0] = 0;
+	pthread_mutex_init(&p->mu, NULL);
+	pthread_cond_init(&p->cv, NULL);
+	p->fd = dup(fd);
+	if (p->fd == -1)
+		goto fail;
+	p->map = textmap(p->fd, n);
+
+	p->counting = pthread_create(&p->tid, NULL, pagecounter, p) == 0;
+	if (!p->counting) {
+		/* no thread: count it all now. */
+		pagecounter(p);
+		if (p->err) {
+			errno = p->err;
+			goto fail;
+		}
+	}
+	return p;
+
+fail:
+	err = errno;
+	pageclose(p);
+	errno = err;
+	return NULL;
+}
+
+/* pageprogress returns how much of the file is counted (0-99), or -1 when all of it is. */
+int
+pageprogress(struct pager *p)
+{
+	int pct;
+
+	pthread_mutex_lock(&p->mu);
+	pct = p->known == p->npg ? -1 : (int)(p->known * 100 / p->npg);
+	pthread_mutex_unlock(&p->mu);
+	return pct;
+}
+
+/* pageclose frees the pager and closes its descriptor. */
+void
+pageclose(struct pager *p)
+{
+	size_t i;
+
+	if (!p)
+		return;
+	if (p->counting) {
+		pthread_mutex_lock(&p->mu);
+		p->stop = true;
+		pthread_mutex_unlock(&p->mu);
+		pthread_join(p->tid, NULL);
+	}
+	pthread_mutex_destroy(&p->mu);
+	pthread_cond_destroy(&p->cv);
+	for (i = 0; i < pagewin; i++)
+		free(p->w[i].s);
+	textunmap(p->map, p->len);
+	if (p->fd != -1)
+		close(p->fd);
+	free(p->nlpre);
+	free(p);
+}
+
+/* pageget returns the bytes at off up to the end of their page (*n = count). */
+const char *
+pageget(struct pager *p, size_t off, size_t *n)
+{
+	size_t no, k;
+
+	if (off >= p->len) {
+		*n = 0;
+		return "";
+	}
+	no = off / pagesz;
+	k = off - no * pagesz;
+	*n = pagelen(p, no) - k;
+	return pageload(p, no) + k;
+}
+
+/* pagenl returns the number of newlines in [off,off+n). */
+size_t
+pagenl(struct pager *p, size_t off, size_t n)
+{
+	return pagerank(p, off + n) - pagerank(p, off);
+}
+
+/* pagenlpos returns the offset of the nth newline (1-based) at or after off, or the file length. */
+size_t
+pagenlpos(struct pager *p, size_t off, size_t nth)
+{
+	const char *s, *q, *end;
+	size_t want, lo, hi;
+
+	if (nth == 0)
+		return p->len;
+	want = pagerank(p, off) + nth;
+	pagewait(p, p->npg, want - 1);
+	pthread_mutex_lock(&p->mu);
+	hi = p->known;
+	pthread_mutex_unlock(&p->mu);
+	if (want > p->nlpre[hi])
+		return p->len;
+
+	/* find the page holding newline number want, then walk to it. */
+	lo = 0;
+	while (lo + 1 < hi) {
+		size_t mid;
+
+		mid = lo + (hi - lo) / 2;
+		if (p->nlpre[mid] < want)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	want -= p->nlpre[lo];
+	s = pageload(p, lo);
+	end = s + pagelen(p, lo);
+	for (q = s; (q = memchr(q, '\n', (size_t)(end - q))) != NULL; q++)
+		if (--want == 0)
+			return lo * pagesz + (size_t)(q - s);
+	return p->len;
+}
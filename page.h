@@ -0,0 +1,36 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include "wee.h"
+
+/*
+ * windowed file pager.
+ *
+ * serves a file too large to load a page at a time: only a small lru
+ * window of pages read with pread is resident. one newline count per page
+ * is kept, so rows can be located by reading at most one page. the counts
+ * are filled in the background after open; a lookup waits only for the
+ * pages before it.
+ */
+
+struct pager;
+
+/* pageopen opens n bytes of fd (which it dups) and starts counting their newlines; NULL on error. */
+struct pager *pageopen(int fd, size_t n);
+
+/* pageprogress returns how much of the file is counted (0-99), or -1 when all of it is. */
+int pageprogress(struct pager *p);
+
+/* pageclose frees the pager and closes its descriptor. */
+void pageclose(struct pager *p);
+
+/* pageget returns the bytes at off up to the end of their page (*n = count). */
+const char *pageget(struct pager *p, size_t off, size_t *n);
+
+/* pagenl returns the number of newlines in [off,off+n). */
+size_t pagenl(struct pager *p, size_t off, size_t n);
+
+/* pagenlpos returns the offset of the nth newline (1-based) at or after off, or the file length. */
+size_t pagenlpos(struct pager *p, size_t off, size_t nth);
+
+#endif
@@ -4,24 +4,68 @@
 #include "lines.h"
 #include "sbuf.h"
 #include "status.h"
-#include "utf.h"
+#include "text.h"
+#include "wee_util.h"
 
 /*
  * rendering pipeline.
  *
  * scroll() maintains rowoff/coloff so E.cur stays visible.
- * refresh() redraws the full screen each keypress.
+ * refresh() draws each frame into a grid of cells and diffs it against
+ * the grid last sent to the terminal, so only changed spans go out; a
+ * vertical scroll first shifts the terminal's rows in a scroll region.
  */
 
+enum {
+	ainv = 1, /* inverse video */
+	gapmax = 4, /* unchanged cells rewritten rather than skipped */
+};
+
+/* cell is one screen column: a utf-8 sequence and its attributes. */
+struct cell {
+	char ch[4];
+	unsigned char len;
+	unsigned char attr;
+};
+
+/* viewkey is what the text rows of a frame were drawn from. */
+struct viewkey {
+	unsigned long editgen;
+	size_t rowoff;
+	int coloff;
+	int w;
+	size_t relrow;
+	int hasvis;
+	size_t sa, sb;
+};
+
+/*
+ * screen is the terminal as last written (old) and the frame being drawn
+ * (cur). py/px is the terminal cursor when pknown; pen is the current sgr.
+ */
+static struct {
+	struct cell *old, *cur;
+	int rows, cols;
+	bool valid;
+	struct viewkey key;
+	int shape;
+	int py, px;
+	bool pknown;
+	int pen;
+} scr;
+
+static const struct cell blank = {{' '}, 1, 0};
+
 /* scroll updates viewport offsets to keep the cursor visible. */
 static void
 scroll(struct editor *e)
 {
-	int cy, cx;
+	size_t cy;
+	int cx;
 	int w, textcols;
 
-	cy = off2row(e, e->cur);
-	cx = off2col(e, e->cur);
+	cy = currow(e);
+	cx = curcol(e);
 	w = numw(e);
 	textcols = e->screencols - w;
 	if (textcols < 1)
@@ -29,217 +73,535 @@ scroll(struct editor *e)
 
 	if (cy < e->rowoff)
 		e->rowoff = cy;
-	if (cy >= e->rowoff + e->textrows)
-		e->rowoff = cy - e->textrows + 1;
+	if (cy >= e->rowoff + (size_t)e->textrows)
+		e->rowoff = cy - (size_t)e->textrows + 1;
 
 	if (cx < e->coloff)
 		e->coloff = cx;
 	if (cx >= e->coloff + textcols)
 		e->coloff = cx - textcols + 1;
 
-	if (e->rowoff < 0)
-		e->rowoff = 0;
 	if (e->coloff < 0)
 		e->coloff = 0;
 }
 
-/* drawrows draws the visible buffer rows into the append buffer. */
+/* gridsize (re)allocates the grids for the window; a new size redraws all. */
 static void
-drawrows(struct editor *e, struct sbuf *ab)
+gridsize(struct editor *e)
+{
+	int rows, cols;
+	size_t n;
+
+	rows = e->textrows + 2;
+	cols = e->screencols > 0 ? e->screencols : 1;
+	if (scr.old && rows == scr.rows && cols == scr.cols)
+		return;
+	n = (size_t)rows * (size_t)cols;
+	free(scr.old);
+	free(scr.cur);
+	scr.old = malloc(n * sizeof(*scr.old));
+	scr.cur = malloc(n * sizeof(*scr.cur));
+	if (!scr.old || !scr.cur)
+		die("out of memory");
+	scr.rows = rows;
+	scr.cols = cols;
+	scr.valid = false;
+}
+
+/* gridrow returns row y of the frame being drawn. */
+static struct cell *
+gridrow(int y)
+{
+	return scr.cur + (size_t)y * (size_t)scr.cols;
+}
+
+/* rowclear blanks row y of the frame being drawn. */
+static void
+rowclear(int y, int attr)
+{
+	struct cell *r;
+	int x;
+
+	r = gridrow(y);
+	for (x = 0; x < scr.cols; x++) {
+		r[x] = blank;
+		r[x].attr = (unsigned char)attr;
+	}
+}
+
+/* putcell stores the n-byte sequence s at column x of row r. */
+static void
+putcell(struct cell *r, int x, const void *s, size_t n, int attr)
+{
+	struct cell c = {{0}, 0, 0};
+
+	if (x < 0 || x >= scr.cols)
+		return;
+	/* longer runs are malformed utf-8; keep what a terminal would read. */
+	if (n > sizeof(c.ch))
+		n = sizeof(c.ch);
+	memcpy(c.ch, s, n);
+	c.len = (unsigned char)n;
+	c.attr = (unsigned char)attr;
+	r[x] = c;
+}
+
+/* putstr stores s from column x, one codepoint per cell; returns the end. */
+static int
+putstr(struct cell *r, int x, const char *s, size_t n, int attr)
+{
+	size_t i, j;
+
+	for (i = 0; i < n && x < scr.cols; i = j, x++) {
+		j = i + 1;
+		while (j < n && ((unsigned char)s[j] & 0xc0) == 0x80)
+			j++;
+		putcell(r, x, s + i, j - i, attr);
+	}
+	return x;
+}
+
+/* viewof collects the inputs drawrows depends on. */
+static struct viewkey
+viewof(struct editor *e)
+{
+	struct viewkey k;
+
+	k.editgen = e->editgen;
+	k.rowoff = e->rowoff;
+	k.coloff = e->coloff;
+	k.w = numw(e);
+	k.relrow = 0;
+	if (k.w && e->shownumrel)
+		k.relrow = currow(e) + 1;
+	k.hasvis = visrange(e, &k.sa, &k.sb);
+	return k;
+}
+
+/* samekey reports whether two frames' text rows were drawn alike. */
+static bool
+samekey(const struct viewkey *a, const struct viewkey *b)
+{
+	return a->editgen == b->editgen && a->rowoff == b->rowoff &&
+		a->coloff == b->coloff && a->w == b->w && a->relrow == b->relrow &&
+		a->hasvis == b->hasvis && (!a->hasvis || (a->sa == b->sa && a->sb == b->sb));
+}
+
+/* drawrows draws the visible buffer rows into the frame. */
+static void
+drawrows(struct editor *e)
 {
 	int y;
 	size_t off;
 	int w, digits;
-	int lineno;
-	int lcount;
-	int curline;
+	size_t lineno;
+	size_t curline;
+	bool eof;
 
+	/* rows are walked from rowoff, so the total line count is never needed. */
 	off = row2off(e, e->rowoff);
 	w = numw(e);
 	digits = w ? (w - 1) : 0;
-	lcount = linecount(e);
-	curline = off2row(e, e->cur) + 1;
+	curline = currow(e) + 1;
+	eof = false;
 	for (y = 0; y < e->textrows; y++) {
+		struct cell *r;
 		size_t ls, le;
 		int cols;
 		int col;
 		size_t i;
-		int inv;
 		size_t sa, sb;
 		int hasvis;
 
+		r = gridrow(y);
+		rowclear(y, 0);
 		ls = off;
-		lineno = e->rowoff + y + 1;
+		lineno = e->rowoff + (size_t)y + 1;
 		cols = e->screencols - w;
 		if (cols < 1)
 			cols = 1;
-		if (lineno > lcount) {
-			if (w) {
-				int n;
-
-				sbufins(NULL, ab, ab->len, "~", 1);
-				n = w - 1;
-				while (n-- > 0)
-					sbufins(NULL, ab, ab->len, " ", 1);
-			} else {
-				sbufins(NULL, ab, ab->len, "~", 1);
-			}
-		} else {
-			le = lineend(e, ls);
-			hasvis = visrange(e, &sa, &sb);
-			if (w) {
-				char nb[32];
-				int n;
-				int shown;
-
-				shown = lineno;
-				if (e->shownumrel && lineno != curline)
-					shown = lineno > curline ? (lineno - curline) : (curline - lineno);
-				n = snprintf(nb, sizeof(nb), "%*d ", digits, shown);
-				if (n > 0)
-					sbufins(NULL, ab, ab->len, nb, (size_t)n);
-			}
-			col = 0;
-			inv = 0;
-			i = ls;
-			while (i < le && i < e->buf.len && e->buf.s[i] != '\n') {
-				unsigned char c;
-				size_t j;
-				int k;
-				int n;
-				int wantinv;
-
-				if (col >= e->coloff + cols)
-					break;
-				c = (unsigned char)e->buf.s[i];
-				wantinv = hasvis && i >= sa && i < sb;
-				if (wantinv != inv) {
-					if (wantinv)
-						sbufins(NULL, ab, ab->len, "\x1b[7m", 4);
-					else
-						sbufins(NULL, ab, ab->len, "\x1b[m", 3);
-					inv = wantinv;
-				}
-				if (c == '\t') {
-					n = tabstop - (col % tabstop);
-					for (k = 0; k < n; k++) {
-						if (col >= e->coloff && col < e->coloff + cols)
-							sbufins(NULL, ab, ab->len, " ", 1);
-						col++;
-						if (col >= e->coloff + cols)
-							break;
-					}
-					i++;
-					continue;
+		if (eof) {
+			putcell(r, 0, "~", 1, 0);
+			continue;
+		}
+		le = lineend(e, ls);
+		hasvis = visrange(e, &sa, &sb);
+		if (w) {
+			char nb[32];
+			int n;
+			size_t shown;
+
+			shown = lineno;
+			if (e->shownumrel && lineno != curline)
+				shown = lineno > curline ? (lineno - curline) : (curline - lineno);
+			n = snprintf(nb, sizeof(nb), "%*zu ", digits, shown);
+			if (n > 0)
+				putstr(r, 0, nb, (size_t)n, 0);
+		}
+		/* start at the column window, not the line start. */
+		i = colseek(e, ls, le, e->coloff, &col);
+		while (i < le && i < textlen(e) && textbyte(e, i) != '\n') {
+			unsigned char c;
+			char b[4];
+			size_t j;
+			int k;
+			int n;
+			int attr;
+
+			if (col >= e->coloff + cols)
+				break;
+			c = textbyte(e, i);
+			attr = hasvis && i >= sa && i < sb ? ainv : 0;
+			if (c == '\t') {
+				n = tabstop - (col % tabstop);
+				for (k = 0; k < n; k++) {
+					if (col >= e->coloff && col < e->coloff + cols)
+						putcell(r, w + col - e->coloff, " ", 1, attr);
+					col++;
+					if (col >= e->coloff + cols)
+						break;
 				}
-				j = utfnext(e->buf.s, e->buf.len, i);
-				if (j <= i)
-					j = i + 1;
-				if (col >= e->coloff && col < e->coloff + cols)
-					sbufins(NULL, ab, ab->len, e->buf.s + i, j - i);
-				col++;
-				i = j;
+				i++;
+				continue;
+			}
+			j = textnext(e, i);
+			if (j <= i)
+				j = i + 1;
+			if (col >= e->coloff && col < e->coloff + cols) {
+				n = j - i < sizeof(b) ? (int)(j - i) : (int)sizeof(b);
+				textcopy(e, i, (size_t)n, b);
+				putcell(r, w + col - e->coloff, b, (size_t)n, attr);
 			}
-			if (inv)
-				sbufins(NULL, ab, ab->len, "\x1b[m", 3);
-			off = (le < e->buf.len && e->buf.s[le] == '\n') ? le + 1 : le;
+			col++;
+			i = j;
 		}
-		sbufins(NULL, ab, ab->len, "\x1b[K", 3);
-		sbufins(NULL, ab, ab->len, "\r\n", 2);
+		if (le < textlen(e) && textbyte(e, le) == '\n')
+			off = le + 1;
+		else
+			eof = true;
 	}
 }
 
 /* drawstatus draws the inverted status bar. */
 static void
-drawstatus(struct editor *e, struct sbuf *ab)
+drawstatus(struct editor *e)
 {
-	char left[128], right[128];
-	int llen, rlen;
-	int lcount, row, col;
+	char left[128], right[128], count[32];
+	struct cell *r;
+	int x, rlen;
+	int pct, col;
+	size_t row;
 
-	row = off2row(e, e->cur) + 1;
-	col = off2col(e, e->cur) + 1;
-	lcount = linecount(e);
+	row = currow(e) + 1;
+	col = curcol(e) + 1;
+	pct = linesprogress(e);
+	if (pct >= 0)
+		snprintf(count, sizeof(count), "indexing %d%%", pct);
+	else
+		snprintf(count, sizeof(count), "%zu lines", linecount(e));
 
-	snprintf(left, sizeof(left), " %s%s - %d lines [%s] ",
+	snprintf(left, sizeof(left), " %s%s - %s [%s] ",
 		e->filename ? e->filename : "[No Name]",
 		e->dirty ? "*" : "",
-		lcount,
+		count,
 		modestr(e));
-	snprintf(right, sizeof(right), " %d,%d ", row, col);
+	snprintf(right, sizeof(right), " %zu,%d ", row, col);
 
-	llen = (int)strlen(left);
+	rowclear(e->textrows, ainv);
+	r = gridrow(e->textrows);
+	x = putstr(r, 0, left, strlen(left), ainv);
 	rlen = (int)strlen(right);
-
-	sbufins(NULL, ab, ab->len, "\x1b[7m", 4);
-	if (llen > e->screencols)
-		llen = e->screencols;
-	sbufins(NULL, ab, ab->len, left, (size_t)llen);
-	while (llen < e->screencols) {
-		if (e->screencols - llen == rlen) {
-			sbufins(NULL, ab, ab->len, right, (size_t)rlen);
-			llen += rlen;
-			break;
-		}
-		sbufins(NULL, ab, ab->len, " ", 1);
-		llen++;
-	}
-	sbufins(NULL, ab, ab->len, "\x1b[m", 3);
-	sbufins(NULL, ab, ab->len, "\r\n", 2);
+	if (scr.cols - x >= rlen)
+		putstr(r, scr.cols - rlen, right, (size_t)rlen, ainv);
 }
 
 /* drawmsg draws the command line (in CMD) or transient status message. */
 static void
-drawmsg(struct editor *e, struct sbuf *ab)
+drawmsg(struct editor *e)
 {
+	struct cell *r;
+	int x;
+
+	rowclear(e->textrows + 1, 0);
+	r = gridrow(e->textrows + 1);
 	if (e->mode == mcmd) {
 		char p;
 
 		p = e->cmdpre ? e->cmdpre : ':';
-		sbufins(NULL, ab, ab->len, &p, 1);
+		x = putstr(r, 0, &p, 1, 0);
 		if (e->cmd.len)
-			sbufins(NULL, ab, ab->len, e->cmd.s, e->cmd.len);
-		sbufins(NULL, ab, ab->len, "\x1b[K", 3);
+			putstr(r, x, e->cmd.s, e->cmd.len, 0);
 		return;
 	}
 
-	if (e->status[0] && time(NULL) - e->statustime < 5) {
-		size_t n;
+	if (statusshown(e))
+		putstr(r, 0, e->status, strlen(e->status), 0);
+}
+
+/* moveto puts the terminal cursor at row y, column x (0-based). */
+static void
+moveto(struct sbuf *ab, int y, int x)
+{
+	char buf[32];
+	int n;
+
+	if (scr.pknown && scr.py == y && scr.px == x)
+		return;
+	if (scr.pknown && scr.py == y && x == 0)
+		n = snprintf(buf, sizeof(buf), "\r");
+	else if (scr.pknown && scr.py == y && x > scr.px)
+		n = snprintf(buf, sizeof(buf), "\x1b[%dC", x - scr.px);
+	else
+		n = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+	sbufins(ab, ab->len, buf, (size_t)n);
+	scr.py = y;
+	scr.px = x;
+	scr.pknown = true;
+}
 
-		n = strlen(e->status);
-		if ((int)n > e->screencols)
-			n = (size_t)e->screencols;
-		sbufins(NULL, ab, ab->len, e->status, n);
+/* setpen switches the terminal to attributes attr. */
+static void
+setpen(struct sbuf *ab, int attr)
+{
+	if (attr == scr.pen)
+		return;
+	if (attr & ainv)
+		sbufins(ab, ab->len, "\x1b[7m", 4);
+	else
+		sbufins(ab, ab->len, "\x1b[m", 3);
+	scr.pen = attr;
+}
+
+/* same reports whether two cells draw identically. */
+static bool
+same(const struct cell *a, const struct cell *b)
+{
+	return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+/* odd reports whether the terminal may not draw c one column wide. */
+static bool
+odd(const struct cell *c)
+{
+	unsigned char b;
+
+	b = (unsigned char)c->ch[0];
+	return c->len > 1 || b < 0x20 || b == 0x7f;
+}
+
+/* emit writes cells [a,b) of row y. */
+static void
+emit(struct sbuf *ab, int y, const struct cell *r, int a, int b)
+{
+	int x;
+
+	moveto(ab, y, a);
+	for (x = a; x < b; x++) {
+		setpen(ab, r[x].attr);
+		sbufins(ab, ab->len, r[x].ch, r[x].len);
+		if (odd(&r[x]))
+			scr.pknown = false;
+	}
+	scr.px = b;
+	/* a write into the last column leaves the cursor pending a wrap. */
+	if (b >= scr.cols)
+		scr.pknown = false;
+}
+
+/* clearrow clears row y from column x with \x1b[K. */
+static void
+clearrow(struct sbuf *ab, int y, int x)
+{
+	moveto(ab, y, x);
+	setpen(ab, 0);
+	sbufins(ab, ab->len, "\x1b[K", 3);
+}
+
+/*
+ * diffrow sends what changed in row y: changed spans, bridged across
+ * unchanged gaps shorter than gapmax, and \x1b[K for a blank tail. from
+ * the first odd cell on, the row is rewritten whole since its columns on
+ * the terminal may not line up with ours.
+ */
+static void
+diffrow(struct sbuf *ab, int y)
+{
+	const struct cell *o, *n;
+	int x0, x1, u, t, x, g, k;
+
+	o = scr.old + (size_t)y * (size_t)scr.cols;
+	n = scr.cur + (size_t)y * (size_t)scr.cols;
+	for (x0 = 0; x0 < scr.cols && same(&o[x0], &n[x0]); x0++)
+		;
+	if (x0 == scr.cols)
+		return;
+	for (x1 = scr.cols - 1; x1 > x0 && same(&o[x1], &n[x1]); x1--)
+		;
+	for (u = 0; u < scr.cols && !odd(&o[u]) && !odd(&n[u]); u++)
+		;
+	for (t = scr.cols; t > 0 && same(&n[t - 1], &blank); t--)
+		;
+
+	if (u <= x1) {
+		if (u < x0)
+			x0 = u;
+		if (x0 < t) {
+			emit(ab, y, n, x0, t);
+			if (t < scr.cols) {
+				setpen(ab, 0);
+				sbufins(ab, ab->len, "\x1b[K", 3);
+			}
+		} else {
+			clearrow(ab, y, t);
+		}
+		return;
+	}
+
+	for (x = x0; x <= x1 && x < t; x = g) {
+		if (same(&o[x], &n[x])) {
+			g = x + 1;
+			continue;
+		}
+		for (g = x + 1; g <= x1 && g < t; ) {
+			if (!same(&o[g], &n[g])) {
+				g++;
+				continue;
+			}
+			for (k = g; k <= x1 && k < t && same(&o[k], &n[k]); k++)
+				;
+			if (k > x1 || k >= t || k - g >= gapmax)
+				break;
+			g = k;
+		}
+		emit(ab, y, n, x, g);
+	}
+	if (t <= x1) {
+		for (x = t; x <= x1 && same(&o[x], &blank); x++)
+			;
+		if (x <= x1)
+			clearrow(ab, y, t);
+	}
+}
+
+/*
+ * scrollrows shifts the text rows on the terminal up by n (down for n < 0)
+ * inside a scroll region, when more rows of the new frame line up with the
+ * old one shifted than as it stands; diffrow then only draws the rows
+ * scrolled in.
+ */
+static void
+scrollrows(struct sbuf *ab, int rows, int n)
+{
+	char buf[48];
+	size_t rs;
+	int y, a, b, k;
+
+	k = n < 0 ? -n : n;
+	if (n == 0 || k >= rows)
+		return;
+	rs = (size_t)scr.cols * sizeof(*scr.old);
+	a = b = 0;
+	for (y = 0; y < rows; y++) {
+		if (!memcmp(gridrow(y), scr.old + (size_t)y * scr.cols, rs))
+			a++;
+		if (y + n >= 0 && y + n < rows &&
+		    !memcmp(gridrow(y), scr.old + (size_t)(y + n) * scr.cols, rs))
+			b++;
+	}
+	if (b <= a)
+		return;
+
+	setpen(ab, 0);
+	snprintf(buf, sizeof(buf), "\x1b[1;%dr\x1b[%d%c\x1b[r", rows, k, n > 0 ? 'S' : 'T');
+	sbufins(ab, ab->len, buf, strlen(buf));
+	/* setting the region homes the cursor. */
+	scr.py = 0;
+	scr.px = 0;
+	scr.pknown = true;
+	if (n > 0) {
+		memmove(scr.old, scr.old + (size_t)k * scr.cols, (size_t)(rows - k) * rs);
+		y = rows - k;
+	} else {
+		memmove(scr.old + (size_t)k * scr.cols, scr.old, (size_t)(rows - k) * rs);
+		y = 0;
 	}
+	for (a = 0; a < k * scr.cols; a++)
+		scr.old[(size_t)y * scr.cols + a] = blank;
+}
 
-	sbufins(NULL, ab, ab->len, "\x1b[K", 3);
+/* redrawall makes the next refresh repaint the whole screen. */
+void
+redrawall(void)
+{
+	scr.valid = false;
 }
 
-/* refresh redraws the full screen and positions the cursor. */
+/* refresh draws the frame, sends what changed and positions the cursor. */
 void
 refresh(struct editor *e)
 {
-	struct sbuf ab = {0};
+	struct sbuf ab = {0}, d = {0};
+	struct viewkey k;
+	struct cell *tmp;
 	char buf[32];
 	int cy, cx;
-	int w;
+	int w, y, shape;
+	bool drawn;
+	size_t i;
 
 	scroll(e);
-	if (e->mode == minsert)
-		sbufins(NULL, &ab, ab.len, "\x1b[6 q", 5);
-	else
-		sbufins(NULL, &ab, ab.len, "\x1b[2 q", 5);
+	gridsize(e);
+	shape = e->mode == minsert ? 6 : 2;
+	if (shape != scr.shape) {
+		snprintf(buf, sizeof(buf), "\x1b[%d q", shape);
+		sbufins(&ab, ab.len, buf, strlen(buf));
+		scr.shape = shape;
+	}
+	if (!scr.valid) {
+		for (i = 0; i < (size_t)scr.rows * (size_t)scr.cols; i++)
+			scr.old[i] = blank;
+		scr.pen = 0;
+		scr.pknown = true;
+		scr.py = 0;
+		scr.px = 0;
+		sbufins(&d, d.len, "\x1b[m\x1b[H\x1b[2J", 10);
+	}
 
-	sbufins(NULL, &ab, ab.len, "\x1b[?25l", 6);
-	sbufins(NULL, &ab, ab.len, "\x1b[H", 3);
+	/* when only the cursor moved the text rows are those already sent. */
+	k = viewof(e);
+	if (scr.valid && samekey(&k, &scr.key)) {
+		memcpy(scr.cur, scr.old, (size_t)e->textrows * (size_t)scr.cols * sizeof(*scr.cur));
+	} else {
+		drawrows(e);
+		if (scr.valid && k.rowoff != scr.key.rowoff && k.coloff == scr.key.coloff) {
+			if (k.rowoff > scr.key.rowoff && k.rowoff - scr.key.rowoff < (size_t)e->textrows)
+				scrollrows(&d, e->textrows, (int)(k.rowoff - scr.key.rowoff));
+			else if (k.rowoff < scr.key.rowoff && scr.key.rowoff - k.rowoff < (size_t)e->textrows)
+				scrollrows(&d, e->textrows, -(int)(scr.key.rowoff - k.rowoff));
+		}
+	}
+	scr.key = k;
+	drawstatus(e);
+	drawmsg(e);
+	for (y = 0; y < scr.rows; y++)
+		diffrow(&d, y);
+	setpen(&d, 0);
+	scr.valid = true;
+	tmp = scr.old;
+	scr.old = scr.cur;
+	scr.cur = tmp;
 
-	drawrows(e, &ab);
-	drawstatus(e, &ab);
-	drawmsg(e, &ab);
+	/* hide the cursor only while something is drawn. */
+	drawn = d.len > 0;
+	if (drawn) {
+		sbufins(&ab, ab.len, "\x1b[?25l", 6);
+		sbufins(&ab, ab.len, d.s, d.len);
+	}
+	sbuffree(&d);
 
-	cy = off2row(e, e->cur) - e->rowoff + 1;
+	cy = (int)(currow(e) - e->rowoff) + 1;
 	w = numw(e);
-	cx = off2col(e, e->cur) - e->coloff + 1 + w;
+	cx = curcol(e) - e->coloff + 1 + w;
 	if (cy < 1)
 		cy = 1;
 	if (cy > e->textrows)
@@ -248,11 +610,10 @@ refresh(struct editor *e)
 		cx = 1;
 	if (cx > e->screencols)
 		cx = e->screencols;
-
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cy, cx);
-	sbufins(NULL, &ab, ab.len, buf, strlen(buf));
-
-	sbufins(NULL, &ab, ab.len, "\x1b[?25h", 6);
-	write(STDOUT_FILENO, ab.s, ab.len);
-	sbuffree(NULL, &ab);
+	moveto(&ab, cy - 1, cx - 1);
+	if (drawn)
+		sbufins(&ab, ab.len, "\x1b[?25h", 6);
+	if (ab.len)
+		write(STDOUT_FILENO, ab.s, ab.len);
+	sbuffree(&ab);
 }
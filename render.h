@@ -6,4 +6,7 @@
 /* refresh redraws the full screen and positions the cursor. */
 void refresh(struct editor *e);
 
+/* redrawall makes the next refresh repaint the whole screen. */
+void redrawall(void);
+
 #endif
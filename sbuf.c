@@ -1,12 +1,12 @@
 #include "sbuf.h"
 
-#include "lines.h"
 #include "wee_util.h"
 
 /*
  * growable byte buffers.
  *
- * sbuf is used for the main text buffer, yank buffer, command line, and undo.
+ * sbuf is used for the yank buffer, command line, undo text, and as the
+ * storage of the simpler text backends.
  */
 
 /* sbufgrow ensures b->cap is at least need bytes. */
@@ -32,30 +32,26 @@ sbufgrow(struct sbuf *b, size_t need)
 
 /* sbufsetlen resizes b and sets its length (always NUL-terminates). */
 void
-sbufsetlen(struct editor *e, struct sbuf *b, size_t n)
+sbufsetlen(struct sbuf *b, size_t n)
 {
 	sbufgrow(b, n + 1);
 	b->len = n;
 	b->s[b->len] = 0;
-	if (e && b == &e->buf)
-		linesdirty(e);
 }
 
 /* sbuffree frees the buffer storage and resets fields. */
 void
-sbuffree(struct editor *e, struct sbuf *b)
+sbuffree(struct sbuf *b)
 {
 	free(b->s);
 	b->s = NULL;
 	b->len = 0;
 	b->cap = 0;
-	if (e && b == &e->buf)
-		linesdirty(e);
 }
 
 /* sbufins inserts n bytes from p into b at offset at. */
 void
-sbufins(struct editor *e, struct sbuf *b, size_t at, const void *p, size_t n)
+sbufins(struct sbuf *b, size_t at, const void *p, size_t n)
 {
 	if (at > b->len)
 		at = b->len;
@@ -64,13 +60,11 @@ sbufins(struct editor *e, struct sbuf *b, size_t at, const void *p, size_t n)
 	memcpy(b->s + at, p, n);
 	b->len += n;
 	b->s[b->len] = 0;
-	if (e && b == &e->buf)
-		linesdirty(e);
 }
 
 /* sbufdel deletes n bytes from b starting at offset at. */
 void
-sbufdel(struct editor *e, struct sbuf *b, size_t at, size_t n)
+sbufdel(struct sbuf *b, size_t at, size_t n)
 {
 	if (at >= b->len)
 		return;
@@ -79,6 +73,4 @@ sbufdel(struct editor *e, struct sbuf *b, size_t at, size_t n)
 	memmove(b->s + at, b->s + at + n, b->len - (at + n));
 	b->len -= n;
 	b->s[b->len] = 0;
-	if (e && b == &e->buf)
-		linesdirty(e);
 }
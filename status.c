@@ -6,6 +6,10 @@
  * keeps the transient status message and mode display logic.
  */
 
+enum {
+	statussecs = 5, /* how long a status message stays up */
+};
+
 /* setstatus formats a transient status message displayed at the bottom. */
 void
 setstatus(struct editor *e, const char *fmt, ...)
@@ -18,6 +22,27 @@ setstatus(struct editor *e, const char *fmt, ...)
 	e->statustime = time(NULL);
 }
 
+/* statusshown reports whether the status message is still up. */
+bool
+statusshown(struct editor *e)
+{
+	return e->status[0] && time(NULL) - e->statustime < statussecs;
+}
+
+/* statusms returns ms until the status message comes down (-1 if none is up). */
+int
+statusms(struct editor *e)
+{
+	struct timespec ts;
+	long long left;
+
+	if (!statusshown(e))
+		return -1;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	left = ((long long)e->statustime + statussecs) * 1000 - ((long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	return left < 1 ? 1 : (int)left;
+}
+
 /* modestr returns a human-readable mode string for the status line. */
 const char *
 modestr(struct editor *e)
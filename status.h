@@ -6,6 +6,12 @@
 /* setstatus formats a transient status message displayed at the bottom. */
 void setstatus(struct editor *e, const char *fmt, ...);
 
+/* statusshown reports whether the status message is still up. */
+bool statusshown(struct editor *e);
+
+/* statusms returns ms until the status message comes down (-1 if none is up). */
+int statusms(struct editor *e);
+
 /* modestr returns a human-readable mode string for the status line. */
 const char *modestr(struct editor *e);
 
@@ -1,11 +1,13 @@
 #include "term.h"
 
+#include "sbuf.h"
 #include "wee_util.h"
 
 /*
  * terminal i/o.
  *
- * handles raw mode, key decoding, and window size management.
+ * handles raw mode, buffered input and key decoding, and window size
+ * management.
  */
 
 static struct termios origterm;
@@ -15,6 +17,61 @@ static void rawoff(void);
 /* set on SIGWINCH; checked in input loop to force a redraw. */
 static volatile sig_atomic_t winch;
 
+/* the SIGWINCH handler writes to winchfd[1] to wake a sleeping poll. */
+static int winchfd[2] = {-1, -1};
+
+enum {
+	escms = 100, /* how long an ESC waits for the rest of a sequence */
+	pastems = 5000, /* longest silence inside a bracketed paste */
+	watchmax = 8,
+};
+
+/* fds termwait sleeps on besides the terminal, and their handlers. */
+static struct {
+	int fd;
+	void (*fn)(int fd, void *arg);
+	void *arg;
+} watches[watchmax];
+static int nwatch;
+
+/*
+ * input buffer: the terminal is read a block at a time into inbuf, and
+ * keys are decoded from inbuf[inhead..intail).
+ */
+enum {
+	inbufsz = 1 << 13,
+};
+static unsigned char inbuf[inbufsz];
+static size_t inhead, intail;
+
+/* text of the last bracketed paste. */
+static struct sbuf paste;
+static const char pasteclose[] = "\x1b[201~";
+
+enum {
+	pasteendn = sizeof(pasteclose) - 1,
+};
+
+/*
+ * keyseqs maps the final byte and first parameter of a CSI (or SS3, with
+ * no parameter) sequence to a key.
+ */
+static const struct {
+	unsigned char fin;
+	int num;
+	int key;
+} keyseqs[] = {
+	{'A', 0, kup}, {'B', 0, kdown}, {'C', 0, kright}, {'D', 0, kleft},
+	{'H', 0, khome}, {'F', 0, kend},
+	{'P', 0, kf1}, {'Q', 0, kf2}, {'R', 0, kf3}, {'S', 0, kf4},
+	{'~', 1, khome}, {'~', 2, kins}, {'~', 3, kdel}, {'~', 4, kend},
+	{'~', 5, kpgup}, {'~', 6, kpgdn}, {'~', 7, khome}, {'~', 8, kend},
+	{'~', 11, kf1}, {'~', 12, kf2}, {'~', 13, kf3}, {'~', 14, kf4},
+	{'~', 15, kf5}, {'~', 17, kf6}, {'~', 18, kf7}, {'~', 19, kf8},
+	{'~', 20, kf9}, {'~', 21, kf10}, {'~', 23, kf11}, {'~', 24, kf12},
+	{'~', 200, kpaste},
+};
+
 static void
 termonsig(int sig)
 {
@@ -22,12 +79,55 @@ termonsig(int sig)
 	_exit(128 + sig);
 }
 
-/* onsigwinch sets the resize flag (SIGWINCH handler). */
+/* onsigwinch sets the resize flag and wakes termwait (SIGWINCH handler). */
 void
 onsigwinch(int sig)
 {
+	int olderr;
+
 	(void)sig;
 	winch = 1;
+	olderr = errno;
+	if (winchfd[1] >= 0)
+		(void)write(winchfd[1], "", 1);
+	errno = olderr;
+}
+
+/* winchdrain empties the wakeup pipe once a resize has been seen. */
+static void
+winchdrain(void)
+{
+	char buf[64];
+
+	while (read(winchfd[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+/*
+ * waitin sleeps until the terminal has input (1), ms pass (0; -1 waits
+ * forever) or the window is resized or a signal arrives (-1).
+ */
+static int
+waitin(int ms)
+{
+	struct pollfd p[2];
+	int r;
+
+	p[0].fd = STDIN_FILENO;
+	p[0].events = POLLIN;
+	p[1].fd = winchfd[0];
+	p[1].events = POLLIN;
+	r = poll(p, 2, ms);
+	if (r == -1) {
+		if (errno == EINTR)
+			return -1;
+		die("poll: %s", strerror(errno));
+	}
+	if (p[1].revents)
+		winchdrain();
+	if (p[0].revents)
+		return 1;
+	return r == 0 ? 0 : -1;
 }
 
 static int
@@ -44,50 +144,117 @@ utf8len(unsigned char c)
 	return 1;
 }
 
-static int
-readbyte_block(unsigned char *out)
+/* infill reads what the terminal has ready into the drained buffer. */
+static void
+infill(void)
 {
 	ssize_t n;
 
-	for (;;) {
-		if (winch)
+	inhead = intail = 0;
+	n = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+	if (n > 0)
+		intail = (size_t)n;
+	else if (n == 0)
+		die("read: end of input");
+	else if (errno != EAGAIN && errno != EINTR)
+		die("read: %s", strerror(errno));
+}
+
+/*
+ * readbyte takes the next input byte, waiting for it if wait is set and
+ * for at most escms if not. a timeout, resize or signal returns 0.
+ */
+static int
+readbyte(unsigned char *out, bool wait)
+{
+	while (inhead == intail) {
+		if (winch || waitin(wait ? -1 : escms) <= 0)
 			return 0;
-		n = read(STDIN_FILENO, out, 1);
-		if (n == 1)
-			return 1;
-		if (n == 0)
-			continue;
-		if (n == -1) {
-			if (errno == EAGAIN)
-				continue;
-			if (errno == EINTR)
-				return 0;
-			die("read: %s", strerror(errno));
-		}
+		infill();
 	}
+	*out = inbuf[inhead++];
+	return 1;
 }
 
-static int
-readbyte_timeout(unsigned char *out)
+/* unreadbyte gives back the byte readbyte just returned. */
+static void
+unreadbyte(void)
 {
-	ssize_t n;
+	inhead--;
+}
 
-	for (;;) {
-		if (winch)
-			return 0;
-		n = read(STDIN_FILENO, out, 1);
-		if (n == 1)
-			return 1;
-		if (n == 0)
-			return 0;
-		if (n == -1) {
-			if (errno == EAGAIN)
-				continue;
-			if (errno == EINTR)
-				return 0;
+/* pasteend finds the sequence closing a bracketed paste in s[0..n). */
+static char *
+pasteend(char *s, size_t n)
+{
+	char *p, *lim;
+
+	if (n < pasteendn)
+		return NULL;
+	lim = s + n - pasteendn;
+	for (p = s; p <= lim; p++) {
+		p = memchr(p, pasteclose[0], (size_t)(lim - p) + 1);
+		if (!p)
+			return NULL;
+		if (memcmp(p, pasteclose, pasteendn) == 0)
+			return p;
+	}
+	return NULL;
+}
+
+/*
+ * readpaste collects a bracketed paste up to its closing \x1b[201~, in
+ * blocks rather than a byte at a time. bytes read past the end go back
+ * into inbuf for the next key.
+ */
+static void
+readpaste(void)
+{
+	size_t from, i, n;
+	ssize_t r;
+	char *p;
+
+	sbufsetlen(&paste, 0);
+	sbufins(&paste, 0, inbuf + inhead, intail - inhead);
+	inhead = intail;
+	from = 0;
+	while (!(p = pasteend(paste.s + from, paste.len - from))) {
+		/* the marker may straddle two reads. */
+		if (paste.len >= pasteendn)
+			from = paste.len - pasteendn + 1;
+		r = waitin(pastems);
+		if (r < 0)
+			continue;
+		/* the terminal never closed the paste; take what came. */
+		if (r == 0) {
+			p = paste.s + paste.len;
+			break;
+		}
+		i = paste.len;
+		sbufsetlen(&paste, i + sizeof(inbuf));
+		r = read(STDIN_FILENO, paste.s + i, sizeof(inbuf));
+		if (r == 0)
+			die("read: end of input");
+		if (r == -1 && errno != EAGAIN && errno != EINTR)
 			die("read: %s", strerror(errno));
+		sbufsetlen(&paste, i + (r > 0 ? (size_t)r : 0));
+	}
+	i = (size_t)(p - paste.s);
+	inhead = 0;
+	intail = i < paste.len ? paste.len - i - pasteendn : 0;
+	memcpy(inbuf, paste.s + i + (intail ? pasteendn : 0), intail);
+
+	/* terminals send line breaks as \r; store them as \n. */
+	for (n = 0, from = 0; from < i; from++) {
+		if (paste.s[from] == '\r') {
+			paste.s[n++] = '\n';
+			if (from + 1 < i && paste.s[from + 1] == '\n')
+				from++;
+		} else {
+			paste.s[n++] = paste.s[from];
 		}
 	}
+	sbufsetlen(&paste, n);
 }
 
 /* getwinsz reads the current terminal size via ioctl. */
@@ -109,8 +276,8 @@ rawoff(void)
 {
 	tcsetattr(STDIN_FILENO, TCSAFLUSH, &origterm);
 	write(STDOUT_FILENO,
-	    "\x1b[2 q\x1b[?25h",
-	    sizeof("\x1b[2 q\x1b[?25h") - 1);
+	    "\x1b[?2004l\x1b[2 q\x1b[?25h",
+	    sizeof("\x1b[?2004l\x1b[2 q\x1b[?25h") - 1);
 }
 
 /* rawon enables raw mode and registers atexit cleanup. */
@@ -119,11 +286,19 @@ rawon(void)
 {
 	struct termios t;
 	struct sigaction sa;
+	int i;
 
 	if (tcgetattr(STDIN_FILENO, &origterm) == -1)
 		die("tcgetattr: %s", strerror(errno));
 	atexit(rawoff);
 
+	if (pipe(winchfd) == -1)
+		die("pipe: %s", strerror(errno));
+	for (i = 0; i < 2; i++) {
+		fcntl(winchfd[i], F_SETFL, fcntl(winchfd[i], F_GETFL) | O_NONBLOCK);
+		fcntl(winchfd[i], F_SETFD, FD_CLOEXEC);
+	}
+
 	memset(&sa, 0, sizeof(sa));
 	sa.sa_handler = termonsig;
 	sigemptyset(&sa.sa_mask);
@@ -138,11 +313,82 @@ rawon(void)
 	t.c_oflag &= ~(OPOST);
 	t.c_cflag |= (CS8);
 	t.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	/* reads never block: termwait and waitin poll before reading. */
 	t.c_cc[VMIN] = 0;
-	t.c_cc[VTIME] = 1;
+	t.c_cc[VTIME] = 0;
 
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &t) == -1)
 		die("tcsetattr: %s", strerror(errno));
+	/* ask for pastes wrapped in \x1b[200~ ... \x1b[201~. */
+	write(STDOUT_FILENO, "\x1b[?2004h", 8);
+}
+
+/* keepbyte records c in the key's raw bytes, if there is room. */
+static void
+keepbyte(struct key *k, unsigned char c)
+{
+	if (k->n < TERM_KEYMAX)
+		k->b[k->n++] = c;
+}
+
+/*
+ * readseq decodes what follows an ESC. a CSI or SS3 sequence is looked up
+ * in keyseqs with its modifier parameter; complete sequences we do not
+ * know are swallowed (knull) rather than typed. anything else is a lone
+ * ESC, and the byte after it is left for the next key.
+ */
+static void
+readseq(struct key *k)
+{
+	unsigned char c, fin;
+	int p[2], np;
+	size_t i;
+
+	k->key = kesc;
+	if (!readbyte(&c, false))
+		return;
+	if (c != '[' && c != 'O') {
+		unreadbyte();
+		return;
+	}
+	keepbyte(k, c);
+	p[0] = p[1] = 0;
+	np = 0;
+	for (;;) {
+		if (!readbyte(&fin, false))
+			return;
+		keepbyte(k, fin);
+		if (c == 'O')
+			break;
+		if (fin >= '0' && fin <= '9') {
+			if (np < 2 && p[np] < 10000)
+				p[np] = p[np] * 10 + (fin - '0');
+			continue;
+		}
+		if (fin == ';') {
+			np++;
+			continue;
+		}
+		/* other parameter and intermediate bytes. */
+		if (fin >= 0x20 && fin <= 0x3f)
+			continue;
+		break;
+	}
+
+	k->key = knull;
+	/* xterm sends modified keys as \x1b[1;<1+mod><fin>. */
+	if (p[1] > 1)
+		k->mod = p[1] - 1;
+	if (fin != '~' && p[0] == 1)
+		p[0] = 0;
+	for (i = 0; i < sizeof(keyseqs) / sizeof(keyseqs[0]); i++) {
+		if (keyseqs[i].fin == fin && keyseqs[i].num == p[0]) {
+			k->key = keyseqs[i].key;
+			break;
+		}
+	}
+	if (k->key == kpaste)
+		readpaste();
 }
 
 /*
@@ -153,68 +399,25 @@ struct key
 readkeyex(void)
 {
 	struct key k;
-	unsigned char a, b, c;
+	unsigned char c;
 	int need;
 
 	memset(&k, 0, sizeof(k));
 	k.key = knull;
 
-	if (!readbyte_block(&c))
+	if (!readbyte(&c, true))
 		return k;
 	k.b[k.n++] = c;
 
 	if (c == '\x1b') {
-		/* distinguish a lone ESC from an escape sequence */
-		if (!readbyte_timeout(&a)) {
-			k.key = kesc;
-			return k;
-		}
-		k.b[k.n++] = a;
-		if (!readbyte_timeout(&b)) {
-			k.key = kesc;
-			return k;
-		}
-		k.b[k.n++] = b;
-
-		if (a == '[') {
-			if (b >= '0' && b <= '9') {
-				unsigned char t;
-				if (!readbyte_timeout(&t)) {
-					k.key = kesc;
-					return k;
-				}
-				if (k.n < TERM_KEYMAX)
-					k.b[k.n++] = t;
-				if (t == '~') {
-					switch (b) {
-					case '1': k.key = khome; return k;
-					case '3': k.key = kdel; return k;
-					case '4': k.key = kend; return k;
-					case '5': k.key = kpgup; return k;
-					case '6': k.key = kpgdn; return k;
-					case '7': k.key = khome; return k;
-					case '8': k.key = kend; return k;
-					}
-				}
-			} else {
-				switch (b) {
-				case 'A': k.key = kup; return k;
-				case 'B': k.key = kdown; return k;
-				case 'C': k.key = kright; return k;
-				case 'D': k.key = kleft; return k;
-				case 'H': k.key = khome; return k;
-				case 'F': k.key = kend; return k;
-				}
-			}
-		}
-		k.key = kesc;
+		readseq(&k);
 		return k;
 	}
 
 	need = utf8len(c);
 	while (k.n < need && k.n < TERM_KEYMAX) {
 		unsigned char x;
-		if (!readbyte_timeout(&x))
+		if (!readbyte(&x, false))
 			break;
 		k.b[k.n++] = x;
 	}
@@ -240,6 +443,134 @@ readkey(void)
 	return k.key;
 }
 
+/* termpending reports whether input is waiting to be read. */
+bool
+termpending(void)
+{
+	struct pollfd p;
+
+	if (winch)
+		return false;
+	if (inhead != intail)
+		return true;
+	p.fd = STDIN_FILENO;
+	p.events = POLLIN;
+	p.revents = 0;
+	return poll(&p, 1, 0) > 0 && (p.revents & POLLIN);
+}
+
+/*
+ * termintr reports whether ^C is among the input typed so far, for loops
+ * that cannot return to readkey. the input up to and including the ^C is
+ * dropped; without one, what was read stays queued for readkey (the
+ * oldest of it dropped if the buffer is full).
+ */
+bool
+termintr(void)
+{
+	unsigned char *c;
+	ssize_t n;
+
+	if (inhead > 0) {
+		memmove(inbuf, inbuf + inhead, intail - inhead);
+		intail -= inhead;
+		inhead = 0;
+	}
+	if (intail == inbufsz)
+		intail = 0;
+	n = read(STDIN_FILENO, inbuf + intail, inbufsz - intail);
+	if (n > 0)
+		intail += (size_t)n;
+	c = memchr(inbuf, 3, intail);
+	if (!c)
+		return false;
+	inhead = (size_t)(c - inbuf) + 1;
+	return true;
+}
+
+/* termpaste returns the text of the last kpaste key. */
+const char *
+termpaste(size_t *n)
+{
+	*n = paste.len;
+	return paste.s ? paste.s : "";
+}
+
+/*
+ * termwatch makes termwait also sleep on fd and call fn(fd, arg) when it
+ * is readable or hung up. a NULL fn stops watching fd.
+ */
+void
+termwatch(int fd, void (*fn)(int fd, void *arg), void *arg)
+{
+	int i;
+
+	for (i = 0; i < nwatch && watches[i].fd != fd; i++)
+		;
+	if (!fn) {
+		if (i < nwatch)
+			watches[i] = watches[--nwatch];
+		return;
+	}
+	if (i == nwatch) {
+		if (nwatch == watchmax)
+			die("termwatch: too many fds");
+		nwatch++;
+	}
+	watches[i].fd = fd;
+	watches[i].fn = fn;
+	watches[i].arg = arg;
+}
+
+/*
+ * termwait is the editor's event loop. it sleeps until a key is ready, the
+ * window is resized, a watched fd wakes (its handler is run) or ms pass
+ * (-1: no limit), and reports whether a key is ready. nothing wakes an
+ * idle editor.
+ */
+bool
+termwait(int ms)
+{
+	struct pollfd p[2 + watchmax];
+	int fds[watchmax];
+	int i, n, r;
+
+	if (inhead != intail)
+		return true;
+	if (winch)
+		return false;
+	p[0].fd = STDIN_FILENO;
+	p[0].events = POLLIN;
+	p[1].fd = winchfd[0];
+	p[1].events = POLLIN;
+	n = nwatch;
+	for (i = 0; i < n; i++) {
+		fds[i] = watches[i].fd;
+		p[2 + i].fd = fds[i];
+		p[2 + i].events = POLLIN;
+	}
+	r = poll(p, (nfds_t)(2 + n), ms);
+	if (r == -1) {
+		if (errno == EINTR)
+			return false;
+		die("poll: %s", strerror(errno));
+	}
+	if (p[1].revents)
+		winchdrain();
+	/* handlers may unwatch fds, so look each one up again. */
+	for (i = 0; i < n; i++) {
+		int j;
+
+		if (!p[2 + i].revents)
+			continue;
+		for (j = 0; j < nwatch && watches[j].fd != fds[i]; j++)
+			;
+		if (j < nwatch)
+			watches[j].fn(fds[i], watches[j].arg);
+	}
+	return p[0].revents != 0;
+}
+
 /* setwinsz queries terminal size and updates E.screenrows/screencols/textrows. */
 void
 setwinsz(struct editor *e)
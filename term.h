@@ -12,11 +12,14 @@ enum {
  *
  * b[0..n) holds the raw input bytes read from the terminal.
  * key is either a wee key code (kesc, kup, ...) or a byte value (0..255).
+ * mod holds the xterm modifier bits (1 shift, 2 alt, 4 ctrl) of a decoded
+ * escape sequence.
  */
 struct key {
 	unsigned char b[TERM_KEYMAX];
 	int n;
 	int key;
+	int mod;
 };
 
 /* rawon enables raw terminal mode and registers atexit cleanup. */
@@ -28,7 +31,22 @@ int readkey(void);
 /* readkeyex reads one keypress and returns its raw bytes plus decoded key. */
 struct key readkeyex(void);
 
-/* onsigwinch sets an internal resize flag (SIGWINCH handler). */
+/* termpending reports whether input is waiting to be read. */
+bool termpending(void);
+
+/* termintr reports whether ^C was typed, dropping the input up to it. */
+bool termintr(void);
+
+/* termpaste returns the text of the last kpaste key. */
+const char *termpaste(size_t *n);
+
+/* termwatch makes termwait also sleep on fd, calling fn(fd, arg) when it wakes (NULL fn: stop). */
+void termwatch(int fd, void (*fn)(int fd, void *arg), void *arg);
+
+/* termwait sleeps until a key is ready, a resize, a watched fd or ms pass; reports whether a key is ready. */
+bool termwait(int ms);
+
+/* onsigwinch sets an internal resize flag and wakes termwait (SIGWINCH handler). */
 void onsigwinch(int sig);
 
 /* setwinsz queries terminal size and updates e->screenrows/screencols/textrows. */
@@ -0,0 +1,113 @@
+#include "text.h"
+
+/*
+ * main text buffer helpers.
+ *
+ * backend-independent routines built on textspan/textbyte.
+ */
+
+/* isutfcont reports whether c is a utf-8 continuation byte. */
+static bool
+isutfcont(int c)
+{
+	return (c & 0xc0) == 0x80;
+}
+
+/* textcopy copies n bytes starting at at into dst. */
+void
+textcopy(struct editor *e, size_t at, size_t n, char *dst)
+{
+	while (n > 0) {
+		const char *s;
+		size_t k;
+
+		s = textspan(e, at, &k);
+		if (k == 0)
+			break;
+		if (k > n)
+			k = n;
+		memcpy(dst, s, k);
+		dst += k;
+		at += k;
+		n -= k;
+	}
+}
+
+/* textmatch reports whether the n bytes at offset at equal p. */
+bool
+textmatch(struct editor *e, size_t at, const void *p, size_t n)
+{
+	const char *q;
+
+	q = p;
+	if (at > textlen(e) || n > textlen(e) - at)
+		return false;
+	while (n > 0) {
+		const char *s;
+		size_t k;
+
+		s = textspan(e, at, &k);
+		if (k > n)
+			k = n;
+		if (memcmp(s, q, k) != 0)
+			return false;
+		q += k;
+		at += k;
+		n -= k;
+	}
+	return true;
+}
+
+/*
+ * textmap maps n bytes of fd read-only, or returns NULL if it cannot.
+ * backends that keep the file contents immutable serve them straight from
+ * the mapping, so opening only costs page faults on the bytes we look at.
+ */
+const char *
+textmap(int fd, size_t n)
+{
+	void *p;
+
+	if (n == 0)
+		return NULL;
+	p = mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	(void)posix_madvise(p, n, POSIX_MADV_SEQUENTIAL);
+	return p;
+}
+
+/* textunmap releases a mapping made by textmap. */
+void
+textunmap(const char *p, size_t n)
+{
+	if (p)
+		munmap((void *)p, n);
+}
+
+/* textnext steps to the next utf-8 codepoint boundary (or len). */
+size_t
+textnext(struct editor *e, size_t i)
+{
+	size_t len;
+
+	len = textlen(e);
+	if (i >= len)
+		return len;
+	i++;
+	while (i < len && isutfcont(textbyte(e, i)))
+		i++;
+	return i;
+}
+
+/* textprev steps to the previous utf-8 codepoint boundary (or 0). */
+size_t
+textprev(struct editor *e, size_t i)
+{
+	if (i == 0)
+		return 0;
+	i--;
+	while (i > 0 && isutfcont(textbyte(e, i)))
+		i--;
+	return i;
+}
@@ -0,0 +1,82 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include "wee.h"
+
+/*
+ * main text buffer.
+ *
+ * the storage layout is chosen at build time (see TEXT in the Makefile);
+ * everything outside the backend reads and edits E.buf through this api.
+ * pointers returned by textspan are only valid until the next edit (and,
+ * for a paged file, until a few hundred other pages have been read).
+ */
+
+/* textinit allocates an empty main buffer. */
+void textinit(struct editor *e);
+
+/* textclear empties the main buffer. */
+void textclear(struct editor *e);
+
+/* textload replaces the buffer with n bytes read from fd (0 ok, -1 error). */
+int textload(struct editor *e, int fd, size_t n);
+
+/* textlen returns the number of bytes in the buffer. */
+size_t textlen(struct editor *e);
+
+/* textbyte returns the byte at offset at (0 at or past the end). */
+int textbyte(struct editor *e, size_t at);
+
+/* textspan returns the contiguous run of bytes starting at at (*n = its length). */
+const char *textspan(struct editor *e, size_t at, size_t *n);
+
+/* textins inserts n bytes from p at offset at. */
+void textins(struct editor *e, size_t at, const void *p, size_t n);
+
+/* textdel deletes n bytes starting at offset at. */
+void textdel(struct editor *e, size_t at, size_t n);
+
+/* textcopy copies n bytes starting at at into dst. */
+void textcopy(struct editor *e, size_t at, size_t n, char *dst);
+
+/* textmatch reports whether the n bytes at offset at equal p. */
+bool textmatch(struct editor *e, size_t at, const void *p, size_t n);
+
+/* textmap maps n bytes of fd read-only, or returns NULL if it cannot. */
+const char *textmap(int fd, size_t n);
+
+/* textunmap releases a mapping made by textmap. */
+void textunmap(const char *p, size_t n);
+
+/* textnext steps to the next utf-8 codepoint boundary (or len). */
+size_t textnext(struct editor *e, size_t i);
+
+/* textprev steps to the previous utf-8 codepoint boundary (or 0). */
+size_t textprev(struct editor *e, size_t i);
+
+#if defined(TEXT_rope) || defined(TEXT_piece)
+#define TEXT_nl
+
+/*
+ * backends that can count newlines themselves. while textnl reports true,
+ * lines.c maps rows through these instead of keeping its own line table:
+ * always for the rope, and for the piece table when the file is paged.
+ */
+
+/* textnl reports whether the textnl* counts below are maintained. */
+bool textnl(struct editor *e);
+
+/* textnlprogress returns how much of the buffer the counts cover (0-99), or -1 when all of it. */
+int textnlprogress(struct editor *e);
+
+/* textnlcount returns the number of newlines in the buffer. */
+size_t textnlcount(struct editor *e);
+
+/* textnlbefore returns the number of newlines in [0,at). */
+size_t textnlbefore(struct editor *e, size_t at);
+
+/* textnlpos returns the offset of the nth newline (1-based), or len if none. */
+size_t textnlpos(struct editor *e, size_t nth);
+#endif
+
+#endif
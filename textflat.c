@@ -0,0 +1,120 @@
+#include "text.h"
+
+#include "lines.h"
+#include "sbuf.h"
+#include "wee_util.h"
+
+/*
+ * contiguous text backend.
+ *
+ * the whole file lives in one growable byte buffer; edits memmove the tail.
+ * simplest layout, kept as a baseline for the other backends.
+ */
+
+struct text {
+	struct sbuf b;
+};
+
+/* textinit allocates an empty main buffer. */
+void
+textinit(struct editor *e)
+{
+	e->buf = calloc(1, sizeof(*e->buf));
+	if (!e->buf)
+		die("out of memory");
+	sbufsetlen(&e->buf->b, 0);
+	linesdirty(e);
+}
+
+/* textclear empties the main buffer. */
+void
+textclear(struct editor *e)
+{
+	linesdirty(e);
+	sbufsetlen(&e->buf->b, 0);
+}
+
+/* textload replaces the buffer with n bytes read from fd (0 ok, -1 error). */
+int
+textload(struct editor *e, int fd, size_t n)
+{
+	struct sbuf *b;
+	size_t got;
+
+	linesdirty(e);
+	b = &e->buf->b;
+	sbufsetlen(b, n);
+	got = 0;
+	while (got < n) {
+		ssize_t r;
+
+		r = read(fd, b->s + got, n - got);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			sbufsetlen(b, got);
+			return -1;
+		}
+		got += (size_t)r;
+	}
+	return 0;
+}
+
+/* textlen returns the number of bytes in the buffer. */
+size_t
+textlen(struct editor *e)
+{
+	return e->buf->b.len;
+}
+
+/* textbyte returns the byte at offset at (0 at or past the end). */
+int
+textbyte(struct editor *e, size_t at)
+{
+	if (at >= e->buf->b.len)
+		return 0;
+	return (unsigned char)e->buf->b.s[at];
+}
+
+/* textspan returns the contiguous run of bytes starting at at (*n = its length). */
+const char *
+textspan(struct editor *e, size_t at, size_t *n)
+{
+	struct sbuf *b;
+
+	b = &e->buf->b;
+	if (at >= b->len) {
+		*n = 0;
+		return "";
+	}
+	*n = b->len - at;
+	return b->s + at;
+}
+
+/* textins inserts n bytes from p at offset at. */
+void
+textins(struct editor *e, size_t at, const void *p, size_t n)
+{
+	struct sbuf *b;
+
+	b = &e->buf->b;
+	if (at > b->len)
+		at = b->len;
+	linesins(e, at, p, n);
+	sbufins(b, at, p, n);
+}
+
+/* textdel deletes n bytes starting at offset at. */
+void
+textdel(struct editor *e, size_t at, size_t n)
+{
+	struct sbuf *b;
+
+	b = &e->buf->b;
+	if (at >= b->len)
+		return;
+	if (n > b->len - at)
+		n = b->len - at;
+	linesdel(e, at, n);
+	sbufdel(b, at, n);
+}
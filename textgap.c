@@ -0,0 +1,194 @@
+#include "text.h"
+
+#include "lines.h"
+#include "wee_util.h"
+
+/*
+ * gap buffer text backend.
+ *
+ * the text is one allocation with a hole (the gap) at the last edit point:
+ * bytes [0,gs) and [ge,cap) hold the buffer, [gs,ge) is free. an edit first
+ * moves the gap to its offset, costing only the distance moved, so a burst
+ * of typing or backspacing around the cursor is O(1) per byte.
+ */
+
+struct text {
+	char *s;
+	size_t gs;
+	size_t ge;
+	size_t cap;
+};
+
+/* gaplen returns the number of free bytes in the gap. */
+static size_t
+gaplen(struct text *t)
+{
+	return t->ge - t->gs;
+}
+
+/* gapgrow ensures the gap can take need more bytes. */
+static void
+gapgrow(struct text *t, size_t need)
+{
+	size_t nc, tail;
+	char *ns;
+
+	if (gaplen(t) >= need)
+		return;
+	nc = t->cap ? t->cap : 64;
+	while (nc - (t->cap - gaplen(t)) < need)
+		nc *= 2;
+	ns = realloc(t->s, nc);
+	if (!ns)
+		die("out of memory");
+	tail = t->cap - t->ge;
+	memmove(ns + nc - tail, ns + t->ge, tail);
+	t->s = ns;
+	t->ge = nc - tail;
+	t->cap = nc;
+}
+
+/* gapmove moves the gap so that it starts at offset at. */
+static void
+gapmove(struct text *t, size_t at)
+{
+	size_t n;
+
+	if (at < t->gs) {
+		n = t->gs - at;
+		memmove(t->s + t->ge - n, t->s + at, n);
+		t->gs -= n;
+		t->ge -= n;
+	} else if (at > t->gs) {
+		n = at - t->gs;
+		memmove(t->s + t->gs, t->s + t->ge, n);
+		t->gs += n;
+		t->ge += n;
+	}
+}
+
+/* textinit allocates an empty main buffer. */
+void
+textinit(struct editor *e)
+{
+	e->buf = calloc(1, sizeof(*e->buf));
+	if (!e->buf)
+		die("out of memory");
+	linesdirty(e);
+}
+
+/* textclear empties the main buffer. */
+void
+textclear(struct editor *e)
+{
+	struct text *t;
+
+	linesdirty(e);
+	t = e->buf;
+	t->gs = 0;
+	t->ge = t->cap;
+}
+
+/* textload replaces the buffer with n bytes read from fd (0 ok, -1 error). */
+int
+textload(struct editor *e, int fd, size_t n)
+{
+	struct text *t;
+	size_t got;
+
+	textclear(e);
+	t = e->buf;
+	gapgrow(t, n);
+	got = 0;
+	while (got < n) {
+		ssize_t r;
+
+		r = read(fd, t->s + got, n - got);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		got += (size_t)r;
+	}
+	t->gs = got;
+	linesdirty(e);
+	return got == n ? 0 : -1;
+}
+
+/* textlen returns the number of bytes in the buffer. */
+size_t
+textlen(struct editor *e)
+{
+	return e->buf->cap - gaplen(e->buf);
+}
+
+/* textbyte returns the byte at offset at (0 at or past the end). */
+int
+textbyte(struct editor *e, size_t at)
+{
+	struct text *t;
+
+	t = e->buf;
+	if (at < t->gs)
+		return (unsigned char)t->s[at];
+	at += gaplen(t);
+	if (at >= t->cap)
+		return 0;
+	return (unsigned char)t->s[at];
+}
+
+/* textspan returns the contiguous run of bytes starting at at (*n = its length). */
+const char *
+textspan(struct editor *e, size_t at, size_t *n)
+{
+	struct text *t;
+
+	t = e->buf;
+	if (at < t->gs) {
+		*n = t->gs - at;
+		return t->s + at;
+	}
+	at += gaplen(t);
+	if (at >= t->cap) {
+		*n = 0;
+		return "";
+	}
+	*n = t->cap - at;
+	return t->s + at;
+}
+
+/* textins inserts n bytes from p at offset at. */
+void
+textins(struct editor *e, size_t at, const void *p, size_t n)
+{
+	struct text *t;
+
+	t = e->buf;
+	if (n == 0)
+		return;
+	if (at > textlen(e))
+		at = textlen(e);
+	linesins(e, at, p, n);
+	gapgrow(t, n);
+	gapmove(t, at);
+	memcpy(t->s + t->gs, p, n);
+	t->gs += n;
+}
+
+/* textdel deletes n bytes starting at offset at. */
+void
+textdel(struct editor *e, size_t at, size_t n)
+{
+	struct text *t;
+	size_t len;
+
+	t = e->buf;
+	len = textlen(e);
+	if (at >= len)
+		return;
+	if (n > len - at)
+		n = len - at;
+	linesdel(e, at, n);
+	gapmove(t, at);
+	t->ge += n;
+}
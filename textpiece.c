@@ -0,0 +1,566 @@
+#include "text.h"
+
+#include "lines.h"
+#include "nl.h"
+#include "page.h"
+#include "sbuf.h"
+#include "wee_util.h"
+
+/*
+ * piece table text backend.
+ *
+ * the buffer is a sequence of pieces, each naming a run of bytes in either
+ * the immutable original file contents or the append-only add buffer.
+ * the original is mmapped when possible, so nothing is copied until edited.
+ * files over hugefile are handed to a pager instead (page.h), which keeps
+ * a newline count per page; then every piece also counts its newlines
+ * (when first asked, for the original's pieces), so rows never need a
+ * full scan.
+ * edits split/trim pieces and never move text, so an insert or delete costs
+ * O(pieces) instead of O(file size). typing appends to the add buffer and
+ * extends the last piece in place.
+ */
+
+enum {
+	hugefile = 1 << 30, /* page files larger than this */
+};
+
+struct piece {
+	size_t off;
+	size_t len;
+	size_t nl; /* newlines in the piece (paged files only; -1 until counted) */
+	bool add;  /* bytes live in the add buffer (else the original) */
+};
+
+struct text {
+	const char *orig;
+	size_t origlen;
+	bool mapped;
+	struct pager *pg; /* set when the original is paged, not held */
+	struct sbuf add;
+
+	struct piece *p;
+	size_t np;
+	size_t cap;
+	size_t len;
+
+	/* locality hint: piece index hp starts at byte offset ho. */
+	size_t hp;
+	size_t ho;
+
+	/*
+	 * newline hint (paged files only): piece nhp starts at byte offset
+	 * nho with nhn newlines before it. every piece before nhp is counted.
+	 */
+	size_t nhp;
+	size_t nho;
+	size_t nhn;
+	size_t nltot; /* newlines in the buffer; -1 until textnlcount asks */
+};
+
+/* pgrow ensures the piece array can hold need entries. */
+static void
+pgrow(struct text *t, size_t need)
+{
+	size_t nc;
+	struct piece *np;
+
+	if (t->cap >= need)
+		return;
+	nc = t->cap ? t->cap : 16;
+	while (nc < need)
+		nc *= 2;
+	np = realloc(t->p, nc * sizeof(t->p[0]));
+	if (!np)
+		die("out of memory");
+	t->p = np;
+	t->cap = nc;
+}
+
+/* pmake makes room for n pieces at index i. */
+static void
+pmake(struct text *t, size_t i, size_t n)
+{
+	pgrow(t, t->np + n);
+	memmove(t->p + i + n, t->p + i, (t->np - i) * sizeof(t->p[0]));
+	t->np += n;
+}
+
+/* pdrop removes n pieces at index i. */
+static void
+pdrop(struct text *t, size_t i, size_t n)
+{
+	memmove(t->p + i, t->p + i + n, (t->np - i - n) * sizeof(t->p[0]));
+	t->np -= n;
+}
+
+/* pspan returns the bytes from offset k of piece i to the end of the piece or page (*n = count). */
+static const char *
+pspan(struct text *t, size_t i, size_t k, size_t *n)
+{
+	struct piece *p;
+	const char *s;
+	size_t m;
+
+	p = &t->p[i];
+	if (!p->add && t->pg) {
+		s = pageget(t->pg, p->off + k, &m);
+		*n = m < p->len - k ? m : p->len - k;
+		return s;
+	}
+	*n = p->len - k;
+	return (p->add ? t->add.s : t->orig) + p->off + k;
+}
+
+/* pcount returns the number of newlines in bytes [k,k+n) of piece i. */
+static size_t
+pcount(struct text *t, size_t i, size_t k, size_t n)
+{
+	struct piece *p;
+
+	p = &t->p[i];
+	if (p->add)
+		return countnl(t->add.s + p->off + k, n);
+	if (t->pg)
+		return pagenl(t->pg, p->off + k, n);
+	return countnl(t->orig + p->off + k, n);
+}
+
+/*
+ * pfix recounts the newlines of piece i (a no-op unless paged). pieces of
+ * the original are counted by pnl when first needed, so opening or
+ * editing never waits for the pager to count the rest of the file.
+ */
+static void
+pfix(struct text *t, size_t i)
+{
+	if (t->pg)
+		t->p[i].nl = t->p[i].add ? pcount(t, i, 0, t->p[i].len) : (size_t)-1;
+}
+
+/* pnl returns the number of newlines in piece i. */
+static size_t
+pnl(struct text *t, size_t i)
+{
+	if (t->p[i].nl == (size_t)-1)
+		t->p[i].nl = pcount(t, i, 0, t->p[i].len);
+	return t->p[i].nl;
+}
+
+/*
+ * plocate finds the piece containing offset at, walking from the hint.
+ * sets *start to the piece's first offset; returns np (and *start = len)
+ * when at is the end of the buffer.
+ */
+static size_t
+plocate(struct text *t, size_t at, size_t *start)
+{
+	size_t i, o;
+
+	i = t->hp;
+	o = t->ho;
+	if (i > t->np || at < o / 2) {
+		i = 0;
+		o = 0;
+	}
+	while (i > 0 && at < o) {
+		i--;
+		o -= t->p[i].len;
+	}
+	while (i < t->np && at >= o + t->p[i].len) {
+		o += t->p[i].len;
+		i++;
+	}
+	t->hp = i;
+	t->ho = o;
+	*start = o;
+	return i;
+}
+
+/*
+ * pnlocate is plocate for the newline hint: it finds the piece containing
+ * at and sets *start and *nl to its first offset and the newlines before
+ * it, counting only the pieces between the hint and at.
+ */
+static size_t
+pnlocate(struct text *t, size_t at, size_t *start, size_t *nl)
+{
+	size_t i, o, c;
+
+	i = t->nhp;
+	o = t->nho;
+	c = t->nhn;
+	if (i > t->np || at < o / 2) {
+		i = 0;
+		o = 0;
+		c = 0;
+	}
+	while (i > 0 && at < o) {
+		i--;
+		o -= t->p[i].len;
+		c -= pnl(t, i);
+	}
+	while (i < t->np && at >= o + t->p[i].len) {
+		c += pnl(t, i);
+		o += t->p[i].len;
+		i++;
+	}
+	t->nhp = i;
+	t->nho = o;
+	t->nhn = c;
+	*start = o;
+	*nl = c;
+	return i;
+}
+
+/* pnlback moves the newline hint back to piece i before an edit changes it. */
+static void
+pnlback(struct text *t, size_t i)
+{
+	while (t->nhp > i) {
+		t->nhp--;
+		t->nho -= t->p[t->nhp].len;
+		t->nhn -= pnl(t, t->nhp);
+	}
+}
+
+/* textinit allocates an empty main buffer. */
+void
+textinit(struct editor *e)
+{
+	e->buf = calloc(1, sizeof(*e->buf));
+	if (!e->buf)
+		die("out of memory");
+	linesdirty(e);
+}
+
+/* textclear empties the main buffer. */
+void
+textclear(struct editor *e)
+{
+	struct text *t;
+
+	linesdirty(e);
+	t = e->buf;
+	if (t->mapped)
+		textunmap(t->orig, t->origlen);
+	else
+		free((void *)t->orig);
+	pageclose(t->pg);
+	t->pg = NULL;
+	t->orig = NULL;
+	t->origlen = 0;
+	t->mapped = false;
+	sbufsetlen(&t->add, 0);
+	t->np = 0;
+	t->len = 0;
+	t->hp = 0;
+	t->ho = 0;
+	t->nhp = 0;
+	t->nho = 0;
+	t->nhn = 0;
+	t->nltot = (size_t)-1;
+}
+
+/* textload replaces the buffer with n bytes read from fd (0 ok, -1 error). */
+int
+textload(struct editor *e, int fd, size_t n)
+{
+	struct text *t;
+	char *s;
+	size_t got;
+
+	textclear(e);
+	t = e->buf;
+	if (n == 0)
+		return 0;
+	t->origlen = n;
+	if (n > hugefile) {
+		t->pg = pageopen(fd, n);
+		if (!t->pg)
+			return -1;
+	} else {
+		t->orig = textmap(fd, n);
+		t->mapped = t->orig != NULL;
+	}
+	if (!t->pg && !t->mapped) {
+		s = malloc(n);
+		if (!s)
+			die("out of memory");
+		t->orig = s;
+		got = 0;
+		while (got < n) {
+			ssize_t r;
+
+			r = read(fd, s + got, n - got);
+			if (r == -1 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				return -1;
+			got += (size_t)r;
+		}
+	}
+	pgrow(t, 1);
+	t->p[0].off = 0;
+	t->p[0].len = n;
+	t->p[0].add = false;
+	t->np = 1;
+	t->len = n;
+	pfix(t, 0);
+	linesdirty(e);
+	return 0;
+}
+
+/* textlen returns the number of bytes in the buffer. */
+size_t
+textlen(struct editor *e)
+{
+	return e->buf->len;
+}
+
+/* textbyte returns the byte at offset at (0 at or past the end). */
+int
+textbyte(struct editor *e, size_t at)
+{
+	struct text *t;
+	size_t i, o, n;
+
+	t = e->buf;
+	if (at >= t->len)
+		return 0;
+	i = plocate(t, at, &o);
+	return (unsigned char)*pspan(t, i, at - o, &n);
+}
+
+/* textspan returns the contiguous run of bytes starting at at (*n = its length). */
+const char *
+textspan(struct editor *e, size_t at, size_t *n)
+{
+	struct text *t;
+	size_t i, o;
+
+	t = e->buf;
+	if (at >= t->len) {
+		*n = 0;
+		return "";
+	}
+	i = plocate(t, at, &o);
+	return pspan(t, i, at - o, n);
+}
+
+/* textins inserts n bytes from p at offset at. */
+void
+textins(struct editor *e, size_t at, const void *p, size_t n)
+{
+	struct text *t;
+	size_t i, o, k, off;
+
+	t = e->buf;
+	if (n == 0)
+		return;
+	if (at > t->len)
+		at = t->len;
+	linesins(e, at, p, n);
+
+	off = t->add.len;
+	sbufins(&t->add, off, p, n);
+
+	i = plocate(t, at, &o);
+	k = at - o;
+	if (t->pg) {
+		pnlback(t, i > 0 ? i - 1 : 0);
+		if (t->nltot != (size_t)-1)
+			t->nltot += countnl(p, n);
+	}
+	if (k == 0 && i > 0 && t->p[i - 1].add &&
+	    t->p[i - 1].off + t->p[i - 1].len == off) {
+		/* typing at the end of the latest insert: grow it in place. */
+		t->p[i - 1].len += n;
+		if (t->pg)
+			t->p[i - 1].nl += countnl(p, n);
+		t->hp = i - 1;
+		t->ho = o - (t->p[i - 1].len - n);
+	} else if (k == 0) {
+		pmake(t, i, 1);
+		t->p[i].off = off;
+		t->p[i].len = n;
+		t->p[i].add = true;
+		pfix(t, i);
+	} else {
+		pmake(t, i + 1, 2);
+		t->p[i + 2] = t->p[i];
+		t->p[i + 2].off += k;
+		t->p[i + 2].len -= k;
+		t->p[i].len = k;
+		t->p[i + 1].off = off;
+		t->p[i + 1].len = n;
+		t->p[i + 1].add = true;
+		pfix(t, i);
+		pfix(t, i + 1);
+		pfix(t, i + 2);
+	}
+	t->len += n;
+}
+
+/* textdel deletes n bytes starting at offset at. */
+void
+textdel(struct editor *e, size_t at, size_t n)
+{
+	struct text *t;
+	size_t i, j, o, k;
+
+	t = e->buf;
+	if (at >= t->len)
+		return;
+	if (n > t->len - at)
+		n = t->len - at;
+	if (n == 0)
+		return;
+	linesdel(e, at, n);
+
+	if (t->pg && t->nltot != (size_t)-1)
+		t->nltot -= textnlbefore(e, at + n) - textnlbefore(e, at);
+	i = plocate(t, at, &o);
+	if (t->pg)
+		pnlback(t, i);
+	k = at - o;
+	if (k > 0 && k + n < t->p[i].len) {
+		/* hole inside one piece: split it around the deleted bytes. */
+		pmake(t, i + 1, 1);
+		t->p[i + 1] = t->p[i];
+		t->p[i + 1].off += k + n;
+		t->p[i + 1].len -= k + n;
+		t->p[i].len = k;
+		pfix(t, i);
+		pfix(t, i + 1);
+	} else {
+		size_t left;
+
+		left = n;
+		j = i;
+		if (k > 0) {
+			/* keep the head of the first piece. */
+			left -= t->p[i].len - k;
+			t->p[i].len = k;
+			pfix(t, i);
+			j = i + 1;
+		}
+		i = j;
+		while (j < t->np && left >= t->p[j].len) {
+			left -= t->p[j].len;
+			j++;
+		}
+		pdrop(t, i, j - i);
+		if (left > 0) {
+			t->p[i].off += left;
+			t->p[i].len -= left;
+			pfix(t, i);
+		}
+		if (k > 0)
+			o += k;
+		t->hp = i;
+		t->ho = o;
+	}
+	t->len -= n;
+}
+
+/* textnl reports whether the textnl* counts below are maintained. */
+bool
+textnl(struct editor *e)
+{
+	return e->buf->pg != NULL;
+}
+
+/* textnlprogress returns how much of the buffer the counts cover (0-99), or -1 when all of it. */
+int
+textnlprogress(struct editor *e)
+{
+	return e->buf->pg ? pageprogress(e->buf->pg) : -1;
+}
+
+/* textnlcount returns the number of newlines in the buffer. */
+size_t
+textnlcount(struct editor *e)
+{
+	struct text *t;
+	size_t o, c;
+
+	t = e->buf;
+	if (t->nltot == (size_t)-1) {
+		/* count once; edits keep the total after that. */
+		pnlocate(t, t->len, &o, &c);
+		t->nltot = c;
+	}
+	return t->nltot;
+}
+
+/* textnlbefore returns the number of newlines in [0,at). */
+size_t
+textnlbefore(struct editor *e, size_t at)
+{
+	struct text *t;
+	size_t i, o, c;
+
+	t = e->buf;
+	i = pnlocate(t, at, &o, &c);
+	if (i < t->np && at > o)
+		c += pcount(t, i, 0, at - o);
+	return c;
+}
+
+/* textnlpos returns the offset of the nth newline (1-based), or len if none. */
+size_t
+textnlpos(struct editor *e, size_t nth)
+{
+	struct text *t;
+	size_t i, o, c;
+
+	t = e->buf;
+	if (nth == 0)
+		return t->len;
+	i = t->nhp;
+	o = t->nho;
+	c = t->nhn;
+	if (i > t->np || nth <= c / 2) {
+		i = 0;
+		o = 0;
+		c = 0;
+	}
+	while (i > 0 && nth <= c) {
+		i--;
+		o -= t->p[i].len;
+		c -= pnl(t, i);
+	}
+	for (; i < t->np; i++) {
+		struct piece *p;
+
+		t->nhp = i;
+		t->nho = o;
+		t->nhn = c;
+		p = &t->p[i];
+		if (!p->add) {
+			size_t at;
+
+			/* only wait for the pager to count as far as the newline. */
+			at = pagenlpos(t->pg, p->off, nth - c);
+			if (at < p->off + p->len)
+				return o + at - p->off;
+		} else if (nth - c <= p->nl) {
+			const char *s, *q, *end;
+			size_t k;
+
+			k = nth - c;
+			s = t->add.s + p->off;
+			end = s + p->len;
+			for (q = s; (q = memchr(q, '\n', (size_t)(end - q))) != NULL; q++)
+				if (--k == 0)
+					return o + (size_t)(q - s);
+		}
+		c += pnl(t, i);
+		o += p->len;
+	}
+	t->nhp = i;
+	t->nho = o;
+	t->nhn = c;
+	return t->len;
+}
@@ -0,0 +1,721 @@
+#include "text.h"
+
+#include "lines.h"
+#include "nl.h"
+#include "wee_util.h"
+
+/*
+ * rope text backend.
+ *
+ * the buffer is a b-tree whose leaves hold chunks of at most ropeleaf bytes.
+ * every node caches the byte and newline counts of its subtree, so edits
+ * touch one root-to-leaf path (O(log n)) and lines.c can map rows to offsets
+ * by walking the tree instead of keeping a separate line table.
+ *
+ * when the file could be mmapped, leaves borrow their bytes from the mapping
+ * (cap == 0) and are copied to the heap the first time they are edited.
+ *
+ * a loaded file's leaves are not counted at open: a node's newline count is
+ * unknown until something asks for it (rnl) or textnlprogress counts its
+ * way across the file a slice at a time, so the first screen never waits
+ * for a full scan.
+ */
+
+enum {
+	ropefan = 32,      /* max kids of an internal node */
+	ropeleaf = 16384,  /* max bytes in a leaf */
+	ropeslice = 1 << 24, /* most bytes textnlprogress counts per call */
+};
+
+struct rnode {
+	size_t len; /* bytes below this node */
+	size_t nl;  /* newlines below this node (-1 until counted) */
+	int n;      /* number of kids (internal nodes) */
+	struct rnode **kid; /* NULL for a leaf */
+	char *s;    /* leaf bytes */
+	size_t cap; /* 0: s borrows from the file mapping */
+};
+
+struct text {
+	struct rnode *root;
+	const char *map;
+	size_t maplen;
+
+	/* last leaf looked up and its starting offset (reset on edit). */
+	struct rnode *hleaf;
+	size_t hoff;
+};
+
+/* leafnew allocates a leaf holding a copy of p[0,n). */
+static struct rnode *
+leafnew(const char *p, size_t n)
+{
+	struct rnode *x;
+
+	x = calloc(1, sizeof(*x));
+	if (!x)
+		die("out of memory");
+	x->cap = n ? n : 64;
+	x->s = malloc(x->cap);
+	if (!x->s)
+		die("out of memory");
+	memcpy(x->s, p, n);
+	x->len = n;
+	x->nl = countnl(p, n);
+	return x;
+}
+
+/* leafgrow ensures leaf x owns a buffer of at least need bytes (keeping its head). */
+static void
+leafgrow(struct rnode *x, size_t need)
+{
+	size_t nc;
+	char *ns;
+
+	if (x->cap >= need && x->cap > 0)
+		return;
+	nc = x->cap ? x->cap : 64;
+	while (nc < need)
+		nc *= 2;
+	if (nc > ropeleaf && need <= ropeleaf)
+		nc = ropeleaf;
+	if (x->cap == 0) {
+		ns = malloc(nc);
+		if (ns)
+			memcpy(ns, x->s, x->len < nc ? x->len : nc);
+	} else {
+		ns = realloc(x->s, nc);
+	}
+	if (!ns)
+		die("out of memory");
+	x->s = ns;
+	x->cap = nc;
+}
+
+/* nodenew allocates an empty internal node. */
+static struct rnode *
+nodenew(void)
+{
+	struct rnode *x;
+
+	x = calloc(1, sizeof(*x));
+	if (!x)
+		die("out of memory");
+	x->kid = malloc(ropefan * sizeof(x->kid[0]));
+	if (!x->kid)
+		die("out of memory");
+	return x;
+}
+
+/* nodefree frees the subtree rooted at x. */
+static void
+nodefree(struct rnode *x)
+{
+	int i;
+
+	if (x->kid) {
+		for (i = 0; i < x->n; i++)
+			nodefree(x->kid[i]);
+		free(x->kid);
+	}
+	if (x->cap)
+		free(x->s);
+	free(x);
+}
+
+/* nodefix recomputes the cached counts of internal node x from its kids. */
+static void
+nodefix(struct rnode *x)
+{
+	int i;
+
+	x->len = 0;
+	x->nl = 0;
+	for (i = 0; i < x->n; i++) {
+		x->len += x->kid[i]->len;
+		if (x->nl != (size_t)-1)
+			x->nl = x->kid[i]->nl == (size_t)-1 ? (size_t)-1 : x->nl + x->kid[i]->nl;
+	}
+}
+
+/* rnl returns the number of newlines below x, counting what is not counted yet. */
+static size_t
+rnl(struct rnode *x)
+{
+	int i;
+
+	if (x->nl != (size_t)-1)
+		return x->nl;
+	if (!x->kid) {
+		x->nl = countnl(x->s, x->len);
+		return x->nl;
+	}
+	x->nl = 0;
+	for (i = 0; i < x->n; i++)
+		x->nl += rnl(x->kid[i]);
+	return x->nl;
+}
+
+/*
+ * rcount counts the leaves below x left to right until *budget bytes are
+ * spent, adding the bytes it passes to *off. returns whether all of x is
+ * counted.
+ */
+static bool
+rcount(struct rnode *x, size_t *budget, size_t *off)
+{
+	int i;
+
+	if (x->nl != (size_t)-1) {
+		*off += x->len;
+		return true;
+	}
+	if (!x->kid) {
+		if (*budget == 0)
+			return false;
+		x->nl = countnl(x->s, x->len);
+		*budget -= x->len < *budget ? x->len : *budget;
+		*off += x->len;
+		return true;
+	}
+	for (i = 0; i < x->n; i++)
+		if (!rcount(x->kid[i], budget, off))
+			return false;
+	nodefix(x);
+	return true;
+}
+
+/* kidput inserts y as kid i of x (x must have room). */
+static void
+kidput(struct rnode *x, int i, struct rnode *y)
+{
+	memmove(x->kid + i + 1, x->kid + i, (size_t)(x->n - i) * sizeof(x->kid[0]));
+	x->kid[i] = y;
+	x->n++;
+}
+
+/* kiddrop removes kid i of x (without freeing it). */
+static void
+kiddrop(struct rnode *x, int i)
+{
+	memmove(x->kid + i, x->kid + i + 1, (size_t)(x->n - i - 1) * sizeof(x->kid[0]));
+	x->n--;
+}
+
+/* underfull reports whether x should be merged with a sibling. */
+static bool
+underfull(struct rnode *x)
+{
+	if (x->kid)
+		return x->n < ropefan / 4;
+	return x->len < ropeleaf / 4;
+}
+
+/*
+ * rins inserts p[0,n) (n <= ropeleaf, nl newlines) at offset at of x.
+ * returns a new right sibling when x had to split, else NULL.
+ */
+static struct rnode *
+rins(struct rnode *x, size_t at, const char *p, size_t n, size_t nl)
+{
+	struct rnode *y;
+	int i;
+
+	if (!x->kid) {
+		char *tmp;
+		size_t total, half;
+
+		total = x->len + n;
+		if (total <= ropeleaf) {
+			leafgrow(x, total);
+			memmove(x->s + at + n, x->s + at, x->len - at);
+			memcpy(x->s + at, p, n);
+			x->len = total;
+			if (x->nl != (size_t)-1)
+				x->nl += nl;
+			return NULL;
+		}
+		tmp = malloc(total);
+		if (!tmp)
+			die("out of memory");
+		memcpy(tmp, x->s, at);
+		memcpy(tmp + at, p, n);
+		memcpy(tmp + at + n, x->s + at, x->len - at);
+		half = total / 2;
+		y = leafnew(tmp + half, total - half);
+		leafgrow(x, half);
+		memcpy(x->s, tmp, half);
+		x->len = half;
+		x->nl = countnl(x->s, half);
+		free(tmp);
+		return y;
+	}
+
+	/* prefer the end of the left kid so appends stay in one leaf. */
+	for (i = 0; i < x->n - 1 && at > x->kid[i]->len; i++)
+		at -= x->kid[i]->len;
+	y = rins(x->kid[i], at, p, n, nl);
+	x->len += n;
+	if (x->nl != (size_t)-1)
+		x->nl += nl;
+	if (!y)
+		return NULL;
+	if (x->n < ropefan) {
+		kidput(x, i + 1, y);
+		return NULL;
+	}
+
+	/* full: move the upper half of the kids to a new sibling. */
+	{
+		struct rnode *z;
+		int half;
+
+		z = nodenew();
+		half = ropefan / 2;
+		memcpy(z->kid, x->kid + half, (size_t)(ropefan - half) * sizeof(x->kid[0]));
+		z->n = ropefan - half;
+		x->n = half;
+		if (i + 1 <= half)
+			kidput(x, i + 1, y);
+		else
+			kidput(z, i + 1 - half, y);
+		nodefix(x);
+		nodefix(z);
+		return z;
+	}
+}
+
+/* kidmerge merges or rebalances kids i and i+1 of x. */
+static void
+kidmerge(struct rnode *x, int i)
+{
+	struct rnode *a, *b;
+
+	a = x->kid[i];
+	b = x->kid[i + 1];
+	if (!a->kid) {
+		size_t total, half;
+		char *tmp;
+
+		total = a->len + b->len;
+		if (total <= ropeleaf) {
+			leafgrow(a, total);
+			memcpy(a->s + a->len, b->s, b->len);
+			a->len = total;
+			if (a->nl != (size_t)-1)
+				a->nl = b->nl == (size_t)-1 ? (size_t)-1 : a->nl + b->nl;
+			kiddrop(x, i + 1);
+			nodefree(b);
+			return;
+		}
+		tmp = malloc(total);
+		if (!tmp)
+			die("out of memory");
+		memcpy(tmp, a->s, a->len);
+		memcpy(tmp + a->len, b->s, b->len);
+		half = total / 2;
+		leafgrow(a, half);
+		leafgrow(b, total - half);
+		memcpy(a->s, tmp, half);
+		memcpy(b->s, tmp + half, total - half);
+		a->len = half;
+		b->len = total - half;
+		a->nl = countnl(a->s, a->len);
+		b->nl = countnl(b->s, b->len);
+		free(tmp);
+		return;
+	}
+
+	if (a->n + b->n <= ropefan) {
+		memcpy(a->kid + a->n, b->kid, (size_t)b->n * sizeof(b->kid[0]));
+		a->n += b->n;
+		b->n = 0;
+		nodefix(a);
+		kiddrop(x, i + 1);
+		nodefree(b);
+		return;
+	}
+	while (a->n < b->n - 1) {
+		a->kid[a->n++] = b->kid[0];
+		kiddrop(b, 0);
+	}
+	while (b->n < a->n - 1)
+		kidput(b, 0, a->kid[--a->n]);
+	nodefix(a);
+	nodefix(b);
+}
+
+/* rdel deletes [at,at+n) from x (the range must lie inside x). */
+static void
+rdel(struct rnode *x, size_t at, size_t n)
+{
+	size_t off;
+	int i;
+
+	if (!x->kid) {
+		leafgrow(x, x->len);
+		if (x->nl != (size_t)-1)
+			x->nl -= countnl(x->s + at, n);
+		memmove(x->s + at, x->s + at + n, x->len - at - n);
+		x->len -= n;
+		return;
+	}
+
+	off = 0;
+	for (i = 0; i < x->n && n > 0; ) {
+		struct rnode *k;
+		size_t s, m;
+
+		k = x->kid[i];
+		if (at >= off + k->len) {
+			off += k->len;
+			i++;
+			continue;
+		}
+		s = at - off;
+		m = k->len - s < n ? k->len - s : n;
+		n -= m;
+		if (s == 0 && m == k->len) {
+			kiddrop(x, i);
+			nodefree(k);
+			continue;
+		}
+		rdel(k, s, m);
+		off += k->len;
+		i++;
+	}
+
+	for (i = 0; i < x->n; i++) {
+		if (x->n < 2 || !underfull(x->kid[i]))
+			continue;
+		if (i + 1 < x->n)
+			kidmerge(x, i);
+		else
+			kidmerge(x, i - 1);
+	}
+	nodefix(x);
+}
+
+/* textinit allocates an empty main buffer. */
+void
+textinit(struct editor *e)
+{
+	e->buf = calloc(1, sizeof(*e->buf));
+	if (!e->buf)
+		die("out of memory");
+	e->buf->root = leafnew("", 0);
+	linesdirty(e);
+}
+
+/* textclear empties the main buffer. */
+void
+textclear(struct editor *e)
+{
+	struct text *t;
+
+	t = e->buf;
+	nodefree(t->root);
+	t->root = leafnew("", 0);
+	t->hleaf = NULL;
+	textunmap(t->map, t->maplen);
+	t->map = NULL;
+	t->maplen = 0;
+	linesdirty(e);
+}
+
+/* textload replaces the buffer with n bytes read from fd (0 ok, -1 error). */
+int
+textload(struct editor *e, int fd, size_t n)
+{
+	struct text *t;
+	struct rnode **lv;
+	size_t nlv, i, got;
+	int rc;
+
+	textclear(e);
+	t = e->buf;
+	if (n == 0)
+		return 0;
+
+	/*
+	 * cut the file into full leaves (borrowed from the mapping, or read
+	 * straight into place), then stack levels of ropefan on top.
+	 */
+	t->map = textmap(fd, n);
+	if (t->map)
+		t->maplen = n;
+	nlv = (n + ropeleaf - 1) / ropeleaf;
+	lv = malloc(nlv * sizeof(lv[0]));
+	if (!lv)
+		die("out of memory");
+	rc = 0;
+	got = 0;
+	for (i = 0; i < nlv; i++) {
+		struct rnode *x;
+		size_t want, have;
+
+		want = n - got < ropeleaf ? n - got : ropeleaf;
+		x = leafnew("", 0);
+		if (t->map) {
+			free(x->s);
+			x->s = (char *)t->map + got;
+			x->cap = 0;
+			x->len = want;
+			x->nl = (size_t)-1;
+			got += want;
+			lv[i] = x;
+			continue;
+		}
+		leafgrow(x, want);
+		have = 0;
+		while (rc == 0 && have < want) {
+			ssize_t r;
+
+			r = read(fd, x->s + have, want - have);
+			if (r == -1 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				rc = -1;
+			else
+				have += (size_t)r;
+		}
+		x->len = have;
+		x->nl = (size_t)-1;
+		got += have;
+		lv[i] = x;
+	}
+	while (nlv > 1) {
+		size_t j, np;
+
+		np = 0;
+		for (j = 0; j < nlv; j += ropefan) {
+			struct rnode *x;
+			size_t k;
+
+			x = nodenew();
+			for (k = j; k < nlv && k < j + ropefan; k++)
+				x->kid[x->n++] = lv[k];
+			nodefix(x);
+			lv[np++] = x;
+		}
+		nlv = np;
+	}
+	nodefree(t->root);
+	t->root = lv[0];
+	free(lv);
+	/* count the head now; textnlprogress counts the rest. */
+	textnlprogress(e);
+	linesdirty(e);
+	return rc;
+}
+
+/* leafat finds the leaf holding offset at and sets *start to its offset. */
+static struct rnode *
+leafat(struct text *t, size_t at, size_t *start)
+{
+	struct rnode *x;
+	size_t off;
+	int i;
+
+	if (t->hleaf && at >= t->hoff && at - t->hoff < t->hleaf->len) {
+		*start = t->hoff;
+		return t->hleaf;
+	}
+	x = t->root;
+	off = 0;
+	while (x->kid) {
+		for (i = 0; i < x->n - 1 && at - off >= x->kid[i]->len; i++)
+			off += x->kid[i]->len;
+		x = x->kid[i];
+	}
+	t->hleaf = x;
+	t->hoff = off;
+	*start = off;
+	return x;
+}
+
+/* textlen returns the number of bytes in the buffer. */
+size_t
+textlen(struct editor *e)
+{
+	return e->buf->root->len;
+}
+
+/* textbyte returns the byte at offset at (0 at or past the end). */
+int
+textbyte(struct editor *e, size_t at)
+{
+	struct rnode *x;
+	size_t o;
+
+	if (at >= textlen(e))
+		return 0;
+	x = leafat(e->buf, at, &o);
+	return (unsigned char)x->s[at - o];
+}
+
+/* textspan returns the contiguous run of bytes starting at at (*n = its length). */
+const char *
+textspan(struct editor *e, size_t at, size_t *n)
+{
+	struct rnode *x;
+	size_t o;
+
+	if (at >= textlen(e)) {
+		*n = 0;
+		return "";
+	}
+	x = leafat(e->buf, at, &o);
+	*n = x->len - (at - o);
+	return x->s + (at - o);
+}
+
+/* textins inserts n bytes from p at offset at. */
+void
+textins(struct editor *e, size_t at, const void *p, size_t n)
+{
+	struct text *t;
+	const char *q;
+
+	t = e->buf;
+	if (at > textlen(e))
+		at = textlen(e);
+	linesins(e, at, p, n);
+	t->hleaf = NULL;
+	for (q = p; n > 0; ) {
+		struct rnode *y;
+		size_t k;
+
+		k = n < ropeleaf ? n : ropeleaf;
+		y = rins(t->root, at, q, k, countnl(q, k));
+		if (y) {
+			struct rnode *r;
+
+			r = nodenew();
+			r->kid[r->n++] = t->root;
+			r->kid[r->n++] = y;
+			nodefix(r);
+			t->root = r;
+		}
+		at += k;
+		q += k;
+		n -= k;
+	}
+}
+
+/* textdel deletes n bytes starting at offset at. */
+void
+textdel(struct editor *e, size_t at, size_t n)
+{
+	struct text *t;
+
+	t = e->buf;
+	if (at >= textlen(e))
+		return;
+	if (n > textlen(e) - at)
+		n = textlen(e) - at;
+	if (n == 0)
+		return;
+	linesdel(e, at, n);
+	t->hleaf = NULL;
+	rdel(t->root, at, n);
+	while (t->root->kid && t->root->n == 1) {
+		struct rnode *r;
+
+		r = t->root;
+		t->root = r->kid[0];
+		r->n = 0;
+		nodefree(r);
+	}
+	if (t->root->kid && t->root->n == 0) {
+		nodefree(t->root);
+		t->root = leafnew("", 0);
+	}
+}
+
+/* textnl reports whether the textnl* counts below are maintained. */
+bool
+textnl(struct editor *e)
+{
+	(void)e;
+	return true;
+}
+
+/* textnlprogress counts the next slice of the buffer and returns how much the counts cover (0-99), or -1 when all of it. */
+int
+textnlprogress(struct editor *e)
+{
+	struct rnode *x;
+	size_t budget, off;
+
+	x = e->buf->root;
+	if (x->nl != (size_t)-1)
+		return -1;
+	budget = ropeslice;
+	off = 0;
+	if (rcount(x, &budget, &off))
+		return -1;
+	return (int)(off / (x->len / 100 + 1));
+}
+
+/* textnlcount returns the number of newlines in the buffer. */
+size_t
+textnlcount(struct editor *e)
+{
+	return rnl(e->buf->root);
+}
+
+/* textnlbefore returns the number of newlines in [0,at). */
+size_t
+textnlbefore(struct editor *e, size_t at)
+{
+	struct rnode *x;
+	size_t nl;
+	int i;
+
+	if (at >= textlen(e))
+		return textnlcount(e);
+	x = e->buf->root;
+	nl = 0;
+	while (x->kid) {
+		for (i = 0; i < x->n - 1 && at >= x->kid[i]->len; i++) {
+			at -= x->kid[i]->len;
+			nl += rnl(x->kid[i]);
+		}
+		x = x->kid[i];
+	}
+	return nl + countnl(x->s, at);
+}
+
+/* textnlpos returns the offset of the nth newline (1-based), or len if none. */
+size_t
+textnlpos(struct editor *e, size_t nth)
+{
+	struct rnode *x;
+	const char *p;
+	size_t off;
+	int i;
+
+	if (nth == 0)
+		return textlen(e);
+	/* count only the kids before the newline, not the whole buffer. */
+	x = e->buf->root;
+	off = 0;
+	while (x->kid) {
+		for (i = 0; i < x->n - 1 && nth > rnl(x->kid[i]); i++) {
+			nth -= x->kid[i]->nl;
+			off += x->kid[i]->len;
+		}
+		x = x->kid[i];
+	}
+	p = x->s;
+	for (;;) {
+		p = memchr(p, '\n', x->len - (size_t)(p - x->s));
+		if (!p)
+			return textlen(e);
+		if (--nth == 0)
+			break;
+		p++;
+	}
+	return off + (size_t)(p - x->s);
+}
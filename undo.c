@@ -1,8 +1,10 @@
 #include "undo.h"
 
+#include "edit.h"
 #include "lines.h"
 #include "sbuf.h"
 #include "status.h"
+#include "text.h"
 #include "wee_util.h"
 
 /*
@@ -40,7 +42,7 @@ undoclear(struct editor *e)
 	int i;
 
 	for (i = 0; i < e->undolen; i++)
-		sbuffree(NULL, &e->undo[i].text);
+		sbuffree(&e->undo[i].text);
 	free(e->undo);
 	e->undo = NULL;
 	e->undolen = 0;
@@ -59,7 +61,7 @@ undopushins(struct editor *e, size_t at, const void *p, size_t n, size_t cur, bo
 	if (merge && e->undolen > 0) {
 		u = &e->undo[e->undolen - 1];
 		if (u->kind == 'i' && u->grp == e->insgrp && u->at + u->text.len == at) {
-			sbufins(NULL, &u->text, u->text.len, p, n);
+			sbufins(&u->text, u->text.len, p, n);
 			return;
 		}
 	}
@@ -71,13 +73,13 @@ undopushins(struct editor *e, size_t at, const void *p, size_t n, size_t cur, bo
 	u->at = at;
 	u->cur = cur;
 	u->grp = e->insgrp;
-	sbufsetlen(NULL, &u->text, 0);
-	sbufins(NULL, &u->text, 0, p, n);
+	sbufsetlen(&u->text, 0);
+	sbufins(&u->text, 0, p, n);
 }
 
-/* undopushdel records a deletion for undo. */
+/* undopushdel records the deletion of n buffer bytes at at (call before deleting). */
 void
-undopushdel(struct editor *e, size_t at, const void *p, size_t n, size_t cur)
+undopushdel(struct editor *e, size_t at, size_t n, size_t cur)
 {
 	struct undo *u;
 
@@ -91,11 +93,19 @@ undopushdel(struct editor *e, size_t at, const void *p, size_t n, size_t cur)
 	u->at = at;
 	u->cur = cur;
 	u->grp = 0;
-	sbufsetlen(NULL, &u->text, 0);
-	sbufins(NULL, &u->text, 0, p, n);
+	sbufsetlen(&u->text, n);
+	textcopy(e, at, n, u->text.s);
 }
 
-/* undodo applies the last undo entry. */
+/* undojoin makes the last undo entry undo together with the one before it. */
+void
+undojoin(struct editor *e)
+{
+	if (e->undolen > 1)
+		e->undo[e->undolen - 1].join = true;
+}
+
+/* undodo applies the last undo entry (and the entries joined to it). */
 void
 undodo(struct editor *e)
 {
@@ -106,21 +116,23 @@ undodo(struct editor *e)
 		return;
 	}
 
-	u = e->undo[--e->undolen];
 	undomute = true;
-	if (u.kind == 'i') {
-		if (u.at <= e->buf.len)
-			sbufdel(e, &e->buf, u.at, u.text.len);
-		e->cur = u.cur;
-	} else if (u.kind == 'd') {
-		if (u.at <= e->buf.len)
-			sbufins(e, &e->buf, u.at, u.text.s, u.text.len);
-		e->cur = u.cur;
-	}
+	do {
+		u = e->undo[--e->undolen];
+		if (u.kind == 'i') {
+			if (u.at <= textlen(e))
+				bufdel(e, u.at, u.text.len);
+			e->cur = u.cur;
+		} else if (u.kind == 'd') {
+			if (u.at <= textlen(e))
+				bufins(e, u.at, u.text.s, u.text.len);
+			e->cur = u.cur;
+		}
+		sbuffree(&u.text);
+	} while (u.join && e->undolen > 0);
 	undomute = false;
 
 	e->dirty = true;
 	clampcur(e);
-	sbuffree(NULL, &u.text);
 	setstatus(e, "undone");
 }
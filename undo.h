@@ -9,8 +9,11 @@ void undoclear(struct editor *e);
 /* undopushins records an insertion for undo (optionally merged). */
 void undopushins(struct editor *e, size_t at, const void *p, size_t n, size_t cur, bool merge);
 
-/* undopushdel records a deletion for undo. */
-void undopushdel(struct editor *e, size_t at, const void *p, size_t n, size_t cur);
+/* undopushdel records the deletion of n buffer bytes at at (call before deleting). */
+void undopushdel(struct editor *e, size_t at, size_t n, size_t cur);
+
+/* undojoin makes the last undo entry undo together with the one before it. */
+void undojoin(struct editor *e);
 
 /* undodo applies the last undo entry. */
 void undodo(struct editor *e);
@@ -1,10 +1,14 @@
 #include "edit.h"
 #include "file.h"
+#include "job.h"
+#include "lines.h"
 #include "mode.h"
+#include "nl.h"
 #include "render.h"
 #include "sbuf.h"
 #include "status.h"
 #include "term.h"
+#include "text.h"
 #include "wee.h"
 #include "wee_util.h"
 
@@ -14,6 +18,11 @@
  * wires together the editor modules and runs the main refresh/input loop.
  */
 
+enum {
+	burstms = 50, /* longest a burst of typeahead may hold off a redraw */
+	busyms = 100, /* redraw interval while the line index is being built */
+};
+
 struct editor e;
 struct sigaction sa;
 
@@ -45,26 +54,53 @@ initeditor(struct editor *e)
 	e->shownum = false;
 	e->shownumrel = false;
 	e->cmdpre = ':';
-	e->linest = NULL;
+	e->linetab = NULL;
 	e->linelen = 0;
-	e->linecap = 0;
 	e->linedirty = true;
+	e->lineidx = NULL;
+	e->linepart = false;
+	e->linefront = 0;
+	e->editgen = 1;
+	e->linegen = 0;
+	e->lineinfo = NULL;
+	e->cgen = 0;
+	e->job = NULL;
 	e->undo = NULL;
 	e->undolen = 0;
 	e->undocap = 0;
 	e->insgrp = 0;
 
-	sbufsetlen(e, &e->buf, 0);
-	sbufsetlen(e, &e->yank, 0);
-	sbufsetlen(e, &e->cmd, 0);
-	sbufsetlen(e, &e->search, 0);
+	nlinit();
+	textinit(e);
+	sbufsetlen(&e->yank, 0);
+	sbufsetlen(&e->cmd, 0);
+	sbufsetlen(&e->search, 0);
 
 	setstatus(e, "NORMAL");
 }
 
+/* waitms returns how long the loop may wait for input (-1: until there is some). */
+static int
+waitms(struct editor *e)
+{
+	int ms, t;
+
+	ms = jobtick();
+	if (linesbusy(e) && (ms < 0 || ms > busyms))
+		ms = busyms;
+	/* wake to take an expired status message down. */
+	t = statusms(e);
+	if (t >= 0 && (ms < 0 || t < ms))
+		ms = t;
+	return ms;
+}
+
 int
 main(int argc, char **argv)
 {
+	long long t0;
+	int ms;
+
 	rawon();
 	setwinsz(&e);
     setssigaction(&sa);
@@ -79,8 +115,16 @@ main(int argc, char **argv)
 
 	for (;;) {
 		winchtick(&e);
+		/* before drawing: a status that expires in between costs a wakeup, not a stale line. */
+		ms = waitms(&e);
 		refresh(&e);
+		if (!termwait(ms))
+			continue;
 		processkey(&e);
+		/* work through typeahead before drawing again, but keep drawing. */
+		t0 = nowms();
+		while (termpending() && nowms() - t0 < burstms)
+			processkey(&e);
 	}
 
 	return 0;
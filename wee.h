@@ -12,6 +12,8 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -21,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <termios.h>
@@ -30,8 +33,8 @@
 /*
  * core types for wee.
  *
- * wee is a small vi-ish editor. the file lives in a single growable byte buffer
- * (buf). cursor and motions operate on byte offsets into that buffer.
+ * wee is a small vi-ish editor. the file lives in the main text buffer (buf,
+ * see text.h). cursor and motions operate on byte offsets into that buffer.
  */
 
 enum {
@@ -48,6 +51,9 @@ enum {
 	kdown,
 	kleft,
 	kright,
+	kins,
+	kf1, kf2, kf3, kf4, kf5, kf6, kf7, kf8, kf9, kf10, kf11, kf12,
+	kpaste, /* bracketed paste; text from termpaste */
 };
 
 enum mode {
@@ -61,7 +67,13 @@ enum {
 	tabstop = 8,
 };
 
-/* simple growable byte buffer used for the file, yank, cmdline, and undo text. */
+struct text;
+struct lineidx;
+struct linetab;
+struct lineinfo;
+struct job;
+
+/* simple growable byte buffer used for yank, cmdline, and undo text. */
 struct sbuf {
 	char *s;
 	size_t len;
@@ -78,6 +90,7 @@ struct undo {
 	size_t at;
 	size_t cur;
 	int grp;
+	bool join; /* undone together with the entry below */
 	struct sbuf text;
 };
 
@@ -92,12 +105,12 @@ struct editor {
 	char *filename;
 	bool dirty;
 
-	struct sbuf buf;
+	struct text *buf;
 	/* byte offset into buf (kept on utf-8 lead bytes). */
 	size_t cur;
 	size_t vmark;
 
-	int rowoff; /* top line number (0-based) */
+	size_t rowoff; /* top line number (0-based) */
 	int coloff; /* left column (0-based) */
 
 	struct sbuf yank;
@@ -115,11 +128,28 @@ struct editor {
 	bool shownum;
 	bool shownumrel;
 
-	/* cached index of line start offsets in E.buf (rebuilt lazily). */
-	size_t *linest;
-	int linelen;
-	int linecap;
+	/* cached line lengths of E.buf (patched on edit, rebuilt when dirty; lines.c). */
+	struct linetab *linetab;
+	size_t linelen;
 	bool linedirty;
+	struct lineidx *lineidx; /* background build in progress (lines.c) */
+	bool linepart; /* an edit stopped the build: the table covers [0,linefront) */
+	size_t linefront;
+	unsigned long editgen;   /* bumped by every buffer change */
+	/* the line last found by linestart/lineend, valid while linegen == editgen. */
+	size_t linels;
+	size_t linele;
+	unsigned long linegen;
+	struct lineinfo *lineinfo; /* per-line column facts (lines.c) */
+	/* cursor position as of cgen: offset, row, column and its line (lines.c). */
+	size_t cpos;
+	size_t crow;
+	int ccol;
+	size_t cls;
+	size_t cle;
+	unsigned long cgen;
+
+	struct job *job; /* running :run, if any (job.c) */
 
 	struct undo *undo;
 	int undolen;
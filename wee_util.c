@@ -19,3 +19,13 @@ die(const char *fmt, ...)
 	va_end(ap);
 	exit(1);
 }
+
+/* nowms returns a monotonic clock reading in milliseconds. */
+long long
+nowms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
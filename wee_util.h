@@ -6,4 +6,7 @@
 /* die prints an error, clears the screen, and exits(1). */
 void die(const char *fmt, ...);
 
+/* nowms returns a monotonic clock reading in milliseconds. */
+long long nowms(void);
+
 #endif